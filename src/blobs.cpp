@@ -48,17 +48,18 @@ namespace rhost {
                 Rf_error("%s", buf);
             }
 
-            bool to_blob_internal(SEXP sexp, std::vector<char>& blob) {
+            bool to_blob_view_internal(SEXP sexp, const char*& data, size_t& size) {
                 int type = TYPEOF(sexp);
-                size_t length = Rf_length(sexp);
+                data = nullptr;
+                size = 0;
 
                 if (type == NILSXP) {
                     return false;
                 }
 
                 if (type == RAWSXP) {
-                    Rbyte* data = RAW(sexp);
-                    blob.assign(data, data + length);
+                    data = reinterpret_cast<const char*>(RAW(sexp));
+                    size = Rf_length(sexp);
                     return true;
                 }
 
@@ -67,9 +68,17 @@ namespace rhost {
             }
         }
 
-        bool to_blob(SEXP sexp, std::vector<char>& blob) {
+        bool to_blob_view(SEXP sexp, const char*& data, size_t& size) {
             bool result = false;
-            rhost::util::errors_to_exceptions([&] {result = to_blob_internal(sexp, blob); });
+            rhost::util::errors_to_exceptions([&] {result = to_blob_view_internal(sexp, data, size); });
+            return result;
+        }
+
+        bool to_blob(SEXP sexp, std::vector<char>& blob) {
+            const char* data;
+            size_t size;
+            bool result = to_blob_view(sexp, data, size);
+            blob.assign(data, data + size);
             return result;
         }
 
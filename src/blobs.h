@@ -30,6 +30,10 @@ namespace rhost {
         // return value is false. Otherwise, the vector contains the same bytes, and return value is true.
         bool to_blob(SEXP sexp, std::vector<char>& blob);
 
+        // Same as to_blob, but rather than copying the bytes, provides a pointer to them inside sexp, which remains
+        // valid for as long as sexp is protected and not modified. For NILSXP, data is null and size is 0.
+        bool to_blob_view(SEXP sexp, const char*& data, size_t& size);
+
         typedef std::vector<char> blob;
         typedef uint64_t blob_id; // range of values constrained to always fit a double
 
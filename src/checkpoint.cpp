@@ -0,0 +1,207 @@
+/* ****************************************************************************
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved. 
+ *
+ *
+ * This file is part of Microsoft R Host.
+ * 
+ * Microsoft R Host is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Microsoft R Host is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***************************************************************************/
+
+
+#include "stdafx.h"
+#include "checkpoint.h"
+#include "eval.h"
+#include "host.h"
+#include "log.h"
+
+using namespace rhost::log;
+using namespace rhost::util;
+
+namespace rhost {
+    namespace checkpoint {
+#ifdef _WIN32
+        bool start(const fs::path& path, const std::string& compress, completion_handler done) {
+            done("Checkpoints are not supported on Windows.", std::chrono::duration<double>::zero());
+            return true;
+        }
+
+        void abort() {
+        }
+#else
+        namespace {
+            // State of the checkpoint in progress, if any. running_pid is 0 while there's no child process to kill.
+            std::mutex state_mutex;
+            std::condition_variable state_cond;
+            bool is_in_progress, is_aborted;
+            pid_t running_pid;
+            fs::path running_temp_path;
+
+            fs::path temp_path_for(const fs::path& path) {
+                fs::path temp_path = path;
+                temp_path += ".checkpoint";
+                return temp_path;
+            }
+
+            // Runs in the forked child, and never returns to the caller.
+            RHOST_NORETURN void write_checkpoint(const fs::path& path, const std::string& compress, int error_fd) {
+                host::prepare_forked_child();
+
+                std::string temp_name = temp_path_for(path).string();
+
+                std::string error;
+                {
+                    protected_sexp env(Rf_NewEnvironment(R_NilValue, R_NilValue, R_BaseEnv));
+                    Rf_defineVar(Rf_install("file"), protected_sexp(Rf_mkString(temp_name.c_str())).get(), env.get());
+                    protected_sexp compress_value(
+                        compress.empty() ? Rf_ScalarLogical(1) :
+                        compress == "none" ? Rf_ScalarLogical(0) :
+                        Rf_mkString(compress.c_str()));
+                    Rf_defineVar(Rf_install("compress"), compress_value.get(), env.get());
+
+                    ParseStatus ps;
+                    auto result = eval::r_try_eval_str(
+                        "save(list = ls(envir = globalenv(), all.names = TRUE), envir = globalenv(), file = file, compress = compress)",
+                        env.get(), ps);
+                    if (ps != PARSE_OK) {
+                        error = "Couldn't parse checkpoint expression.";
+                    } else if (result.has_error) {
+                        error = result.error.empty() ? "Failed to save workspace." : result.error;
+                    } else if (rename(temp_name.c_str(), path.string().c_str()) != 0) {
+                        error = std::string("Couldn't rename checkpoint file: ") + strerror(errno);
+                    }
+                }
+
+                if (!error.empty()) {
+                    unlink(temp_name.c_str());
+                    write_all(error_fd, error.data(), error.size());
+                }
+
+                // Skip atexit handlers and static destructors, which belong to the parent.
+                _exit(error.empty() ? EXIT_SUCCESS : EXIT_FAILURE);
+            }
+        }
+
+        bool start(const fs::path& path, const std::string& compress, completion_handler done) {
+            auto started_at = std::chrono::steady_clock::now();
+            {
+                std::lock_guard<std::mutex> lock(state_mutex);
+                if (is_aborted) {
+                    done("Host is shutting down.", std::chrono::duration<double>::zero());
+                    return true;
+                }
+                if (is_in_progress) {
+                    return false;
+                }
+                is_in_progress = true;
+            }
+
+            auto finish = [] {
+                {
+                    std::lock_guard<std::mutex> lock(state_mutex);
+                    is_in_progress = false;
+                    running_pid = 0;
+                }
+                state_cond.notify_all();
+            };
+
+            auto fail = [&](const char* what, int err) {
+                std::string error = std::string(what) + strerror(err);
+                finish();
+                done(error, std::chrono::steady_clock::now() - started_at);
+                return true;
+            };
+
+            // The child reports errors through this pipe. Mark it close-on-exec, so that no other process that the
+            // host might spawn later holds on to the write end, and keeps the parent from seeing EOF.
+            int fds[2];
+            if (pipe2(fds, O_CLOEXEC) != 0) {
+                return fail("Couldn't create pipe for checkpoint: ", errno);
+            }
+
+            pid_t pid = fork();
+            if (pid < 0) {
+                int err = errno;
+                close(fds[0]);
+                close(fds[1]);
+                return fail("Couldn't fork checkpoint process: ", err);
+            } else if (pid == 0) {
+                close(fds[0]);
+                write_checkpoint(path, compress, fds[1]);
+            }
+
+            close(fds[1]);
+            logf(log_verbosity::normal, "Writing checkpoint to %s in process %d.\n", path.string().c_str(), pid);
+
+            {
+                std::lock_guard<std::mutex> lock(state_mutex);
+                running_pid = pid;
+                running_temp_path = temp_path_for(path);
+            }
+
+            int error_fd = fds[0];
+            std::thread([=] {
+                std::string error;
+                read_all(error_fd, error);
+                close(error_fd);
+
+                // If something else in the process (e.g. a SIGCHLD handler installed by an R package) has already
+                // reaped the child, its exit status is lost, and the pipe is all there is to go by.
+                int status = 0;
+                pid_t reaped;
+                while ((reaped = waitpid(pid, &status, 0)) < 0 && errno == EINTR) {
+                }
+
+                bool succeeded = reaped == pid ? WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS : error.empty();
+                if (!succeeded) {
+                    if (error.empty()) {
+                        error = "Checkpoint process terminated abnormally.";
+                    }
+                } else {
+                    error.clear();
+                }
+
+                auto elapsed = std::chrono::steady_clock::now() - started_at;
+                logf(log_verbosity::normal, "Checkpoint process %d %s after %.3f s%s%s\n",
+                     pid, error.empty() ? "completed" : "failed", std::chrono::duration<double>(elapsed).count(),
+                     error.empty() ? "." : ": ", error.c_str());
+
+                finish();
+                done(error, elapsed);
+            }).detach();
+
+            return true;
+        }
+
+        void abort() {
+            std::unique_lock<std::mutex> lock(state_mutex);
+            is_aborted = true;
+            if (!is_in_progress) {
+                return;
+            }
+
+            // The thread that started with the child reaps it, and reports the failure; wait for that, so that the
+            // child can't rename its snapshot over whatever is saved after this returns.
+            if (running_pid) {
+                logf(log_verbosity::minimal, "Killing checkpoint process %d.\n", running_pid);
+                kill(running_pid, SIGKILL);
+            }
+            state_cond.wait(lock, [] { return !is_in_progress; });
+
+            unlink(running_temp_path.string().c_str());
+        }
+#endif
+    }
+}
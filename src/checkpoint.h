@@ -0,0 +1,51 @@
+/* ****************************************************************************
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved. 
+ *
+ *
+ * This file is part of Microsoft R Host.
+ * 
+ * Microsoft R Host is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Microsoft R Host is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***************************************************************************/
+
+
+#pragma once
+#include "stdafx.h"
+
+namespace rhost {
+    namespace checkpoint {
+        // Invoked once the checkpoint is written (error is empty), or has failed (error describes why).
+        typedef std::function<void(const std::string& error, std::chrono::duration<double> elapsed)> completion_handler;
+
+        // Saves the global environment to the RData file at path, without blocking R while it is being written.
+        // The host process is forked, so that the child has a copy-on-write snapshot of R heap as it was at the
+        // moment of the call; the child then writes the file and exits, while the parent carries on. The file is
+        // written under a temporary name first, and renamed to path once it's complete, so an existing file at
+        // path is never left partially overwritten.
+        //
+        // compress is passed to save() as is, except that an empty string means TRUE (R default), and "none"
+        // means FALSE. done is invoked on a background thread.
+        //
+        // Must be called on the R thread, when R heap is in a consistent state. Returns false without doing
+        // anything if the previous checkpoint is still being written. Not supported on Windows, where done is
+        // invoked immediately with an error.
+        bool start(const fs::path& path, const std::string& compress, completion_handler done);
+
+        // Kills the child that is writing a checkpoint, if any, waits until it has been reaped, and removes its
+        // temporary file; the checkpoint fails. From then on, start() invokes done with an error immediately. This is
+        // meant for shutdown, so that an older snapshot can't replace the workspace that's saved at exit.
+        void abort();
+    }
+}
@@ -0,0 +1,313 @@
+/* ****************************************************************************
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved. 
+ *
+ *
+ * This file is part of Microsoft R Host.
+ * 
+ * Microsoft R Host is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Microsoft R Host is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***************************************************************************/
+
+
+#include "stdafx.h"
+#include "colstats.h"
+
+namespace rhost {
+    namespace colstats {
+        namespace {
+            // Cells are processed in blocks of this many, checking for cancellation in between.
+            const size_t block_size = 65536;
+
+            // Number of independent accumulators used by reduction loops.
+            const size_t lanes = 4;
+
+            const int na_integer = std::numeric_limits<int>::min();
+
+            // Finalizer of SplitMix64, which spreads every input bit over all output bits.
+            uint64_t mix(uint64_t x) {
+                x ^= x >> 30;
+                x *= 0xbf58476d1ce4e5b9ULL;
+                x ^= x >> 27;
+                x *= 0x94d049bb133111ebULL;
+                x ^= x >> 31;
+                return x;
+            }
+
+            uint64_t hash_string(const char* s) {
+                // FNV-1a
+                uint64_t hash = 0xcbf29ce484222325ULL;
+                for (; *s; ++s) {
+                    hash ^= static_cast<unsigned char>(*s);
+                    hash *= 0x100000001b3ULL;
+                }
+                return mix(hash);
+            }
+
+            uint64_t hash_double(double value) {
+                // 0 and -0 are the same value.
+                if (value == 0) {
+                    value = 0;
+                }
+                uint64_t bits;
+                memcpy(&bits, &value, sizeof bits);
+                return mix(bits);
+            }
+
+            struct totals {
+                size_t na_count = 0;
+                double min = std::numeric_limits<double>::infinity();
+                double max = -std::numeric_limits<double>::infinity();
+                double sum = 0;
+            };
+
+            // The loop is written so that every lane has its own accumulators, and there are no branches, which lets
+            // the compiler vectorize it without having to reassociate floating-point additions.
+            void reduce(const double* x, size_t count, totals& t) {
+                double mins[lanes], maxs[lanes], sums[lanes];
+                size_t nas[lanes];
+                for (size_t k = 0; k < lanes; ++k) {
+                    mins[k] = t.min;
+                    maxs[k] = t.max;
+                    sums[k] = 0;
+                    nas[k] = 0;
+                }
+
+                size_t i = 0;
+                for (; i + lanes <= count; i += lanes) {
+                    for (size_t k = 0; k < lanes; ++k) {
+                        double v = x[i + k];
+                        bool na = v != v;
+                        nas[k] += na;
+                        sums[k] += na ? 0.0 : v;
+                        mins[k] = na || v >= mins[k] ? mins[k] : v;
+                        maxs[k] = na || v <= maxs[k] ? maxs[k] : v;
+                    }
+                }
+                for (; i < count; ++i) {
+                    double v = x[i];
+                    bool na = v != v;
+                    nas[0] += na;
+                    sums[0] += na ? 0.0 : v;
+                    mins[0] = na || v >= mins[0] ? mins[0] : v;
+                    maxs[0] = na || v <= maxs[0] ? maxs[0] : v;
+                }
+
+                for (size_t k = 0; k < lanes; ++k) {
+                    t.na_count += nas[k];
+                    t.sum += sums[k];
+                    t.min = std::min(t.min, mins[k]);
+                    t.max = std::max(t.max, maxs[k]);
+                }
+            }
+
+            void reduce(const int* x, size_t count, totals& t) {
+                int mins[lanes], maxs[lanes];
+                int64_t sums[lanes];
+                size_t nas[lanes];
+                for (size_t k = 0; k < lanes; ++k) {
+                    mins[k] = std::numeric_limits<int>::max();
+                    maxs[k] = std::numeric_limits<int>::min();
+                    sums[k] = 0;
+                    nas[k] = 0;
+                }
+
+                size_t i = 0;
+                for (; i + lanes <= count; i += lanes) {
+                    for (size_t k = 0; k < lanes; ++k) {
+                        int v = x[i + k];
+                        bool na = v == na_integer;
+                        nas[k] += na;
+                        sums[k] += na ? 0 : v;
+                        mins[k] = na || v >= mins[k] ? mins[k] : v;
+                        maxs[k] = na || v <= maxs[k] ? maxs[k] : v;
+                    }
+                }
+                for (; i < count; ++i) {
+                    int v = x[i];
+                    bool na = v == na_integer;
+                    nas[0] += na;
+                    sums[0] += na ? 0 : v;
+                    mins[0] = na || v >= mins[0] ? mins[0] : v;
+                    maxs[0] = na || v <= maxs[0] ? maxs[0] : v;
+                }
+
+                // A block is small enough that its integer sum is exact.
+                for (size_t k = 0; k < lanes; ++k) {
+                    t.na_count += nas[k];
+                    t.sum += static_cast<double>(sums[k]);
+                    if (mins[k] <= maxs[k]) {
+                        t.min = std::min(t.min, static_cast<double>(mins[k]));
+                        t.max = std::max(t.max, static_cast<double>(maxs[k]));
+                    }
+                }
+            }
+
+            template <class T>
+            void add_to_histogram(const T* x, size_t count, double min, double scale, std::vector<uint64_t>& histogram) {
+                size_t last = histogram.size() - 1;
+                for (size_t i = 0; i < count; ++i) {
+                    double v = x[i];
+                    if (v != v || (std::is_same<T, int>::value && x[i] == na_integer)) {
+                        continue;
+                    }
+                    size_t bin = static_cast<size_t>((v - min) * scale);
+                    ++histogram[std::min(bin, last)];
+                }
+            }
+
+            bool summarize_column(const gridview::column& col, size_t nrow, size_t bins, const std::atomic<bool>& canceled, summary& s) {
+                const double nan = std::numeric_limits<double>::quiet_NaN();
+                s.min = s.max = s.mean = nan;
+
+                totals t;
+                hyperloglog hll;
+                for (size_t start = 0; start < nrow; start += block_size) {
+                    if (canceled.load(std::memory_order_relaxed)) {
+                        return false;
+                    }
+
+                    size_t count = std::min(block_size, nrow - start);
+                    switch (col.kind) {
+                    case gridview::column::real: {
+                        const double* x = col.reals + start;
+                        reduce(x, count, t);
+                        for (size_t i = 0; i < count; ++i) {
+                            if (x[i] == x[i]) {
+                                hll.add(hash_double(x[i]));
+                            }
+                        }
+                        break;
+                    }
+                    case gridview::column::integer: {
+                        const int* x = col.integers + start;
+                        reduce(x, count, t);
+                        for (size_t i = 0; i < count; ++i) {
+                            if (x[i] != na_integer) {
+                                hll.add(mix(static_cast<uint32_t>(x[i])));
+                            }
+                        }
+                        break;
+                    }
+                    default:
+                        for (size_t i = start; i < start + count; ++i) {
+                            const char* x = col.strings[i];
+                            if (x) {
+                                hll.add(hash_string(x));
+                            } else {
+                                ++t.na_count;
+                            }
+                        }
+                        break;
+                    }
+                }
+
+                s.na_count = t.na_count;
+                s.count = nrow - t.na_count;
+                s.distinct = s.count ? hll.estimate() : 0;
+                if (col.kind == gridview::column::string || s.count == 0) {
+                    return true;
+                }
+
+                s.min = t.min;
+                s.max = t.max;
+                s.mean = t.sum / s.count;
+
+                if (bins == 0 || !std::isfinite(s.min) || !std::isfinite(s.max)) {
+                    return true;
+                }
+
+                s.histogram.assign(bins, 0);
+                double scale = s.max > s.min ? bins / (s.max - s.min) : 0;
+                for (size_t start = 0; start < nrow; start += block_size) {
+                    if (canceled.load(std::memory_order_relaxed)) {
+                        return false;
+                    }
+
+                    size_t count = std::min(block_size, nrow - start);
+                    if (col.kind == gridview::column::real) {
+                        add_to_histogram(col.reals + start, count, s.min, scale, s.histogram);
+                    } else {
+                        add_to_histogram(col.integers + start, count, s.min, scale, s.histogram);
+                    }
+                }
+
+                return true;
+            }
+        }
+
+        hyperloglog::hyperloglog() :
+            _registers(size_t(1) << precision) {
+        }
+
+        void hyperloglog::add(uint64_t hash) {
+            // The first bits select the register, and the rank of the first set bit among the rest is recorded in it.
+            size_t index = static_cast<size_t>(hash >> (64 - precision));
+            uint64_t rest = (hash << precision) | (uint64_t(1) << (precision - 1));
+
+            uint8_t rank = 1;
+            for (; !(rest & (uint64_t(1) << 63)); rest <<= 1) {
+                ++rank;
+            }
+
+            if (rank > _registers[index]) {
+                _registers[index] = rank;
+            }
+        }
+
+        double hyperloglog::estimate() const {
+            double m = static_cast<double>(_registers.size());
+            double sum = 0;
+            size_t zeros = 0;
+            for (auto r : _registers) {
+                sum += std::ldexp(1.0, -r);
+                zeros += r == 0;
+            }
+
+            double estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+            if (estimate <= 2.5 * m && zeros != 0) {
+                // Linear counting is more accurate for small cardinalities.
+                estimate = m * std::log(m / zeros);
+            }
+            return estimate;
+        }
+
+        bool summarize(const std::vector<gridview::column>& columns, size_t nrow, size_t bins, unsigned thread_count,
+            const std::atomic<bool>& canceled, std::vector<summary>& results) {
+            results.resize(columns.size());
+
+            std::atomic<size_t> next_column(0);
+            auto worker = [&] {
+                for (size_t i; (i = next_column++) < columns.size();) {
+                    if (!summarize_column(columns[i], nrow, bins, canceled, results[i])) {
+                        return;
+                    }
+                }
+            };
+
+            size_t worker_count = std::max<size_t>(1, std::min<size_t>(thread_count, columns.size()));
+            std::vector<std::thread> threads;
+            for (size_t i = 1; i < worker_count; ++i) {
+                threads.emplace_back(worker);
+            }
+            worker();
+
+            for (auto& thread : threads) {
+                thread.join();
+            }
+
+            return !canceled;
+        }
+    }
+}
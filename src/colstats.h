@@ -0,0 +1,67 @@
+/* ****************************************************************************
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved. 
+ *
+ *
+ * This file is part of Microsoft R Host.
+ * 
+ * Microsoft R Host is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Microsoft R Host is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***************************************************************************/
+
+
+#pragma once
+#include "stdafx.h"
+#include "gridview.h"
+
+namespace rhost {
+    namespace colstats {
+        // Summary of a single column, as shown in a data viewer header. Only count, na_count and distinct are
+        // computed for string columns; everything else is NaN or empty for them.
+        struct summary {
+            // Number of cells that are not NA, and that are.
+            size_t count;
+            size_t na_count;
+
+            // Of cells that are not NA.
+            double min, max, mean;
+
+            // Estimated number of distinct values among cells that are not NA (see hyperloglog).
+            double distinct;
+
+            // Number of cells in each of equal-width bins that span [min, max]. Empty if there are no cells that
+            // are not NA, or if min or max is infinite.
+            std::vector<uint64_t> histogram;
+        };
+
+        // Estimates the number of distinct values in a set, in constant memory (4 KiB). The standard error of the
+        // estimate is about 1.6%; small counts are nearly exact.
+        class hyperloglog {
+        public:
+            hyperloglog();
+            void add(uint64_t hash);
+            double estimate() const;
+
+        private:
+            static const int precision = 12;
+            std::vector<uint8_t> _registers;
+        };
+
+        // Summarizes every column on a pool of up to thread_count threads, one column per thread at a time. Like the
+        // gridview kernels, this only reads memory that was gathered beforehand, and doesn't call into R. Checks for
+        // cancellation periodically, and returns false as soon as it notices it, leaving results incomplete.
+        bool summarize(const std::vector<gridview::column>& columns, size_t nrow, size_t bins, unsigned thread_count,
+            const std::atomic<bool>& canceled, std::vector<summary>& results);
+    }
+}
@@ -0,0 +1,284 @@
+/* ****************************************************************************
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved. 
+ *
+ *
+ * This file is part of Microsoft R Host.
+ * 
+ * Microsoft R Host is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Microsoft R Host is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***************************************************************************/
+
+
+#include "stdafx.h"
+#include "completions.h"
+#include "log.h"
+#include "r_api.h"
+#include "util.h"
+
+using namespace rhost::log;
+using namespace rhost::util;
+
+namespace rhost {
+    namespace completions {
+        namespace {
+            struct symbol_info {
+                std::string name;
+                std::string type;
+                picojson::value formals;
+            };
+
+            // Symbols bound in a single environment, ordered by name. Immutable once built, so that queries can
+            // keep using it without locking while the R thread replaces it.
+            struct env_index {
+                std::string name;
+                std::vector<symbol_info> symbols;
+            };
+
+            typedef std::shared_ptr<const env_index> env_index_ptr;
+
+            // The index as seen by query(). update() replaces all of it at once.
+            std::mutex index_mutex;
+            std::vector<env_index_ptr> search_path_index;
+            std::unordered_map<std::string, env_index_ptr> namespace_index;
+            bool is_index_complete = false;
+
+            // Everything that's been indexed so far, by environment. The environments are kept alive for as long
+            // as they're here, so that a new environment cannot be allocated at the same address and mistaken for
+            // an indexed one. Only used on the R thread.
+            struct indexed_env {
+                protected_sexp env;
+                env_index_ptr index;
+            };
+            std::unordered_map<SEXP, indexed_env> indexed_envs;
+
+            symbol_info describe_symbol(SEXP env, SEXP sym) {
+                symbol_info info;
+                info.name = Rchar_to_utf8(R_CHAR(PRINTNAME(sym)));
+
+                if (R_BindingIsActive(sym, env)) {
+                    info.type = "active";
+                    return info;
+                }
+
+                SEXP value = Rf_findVarInFrame(env, sym);
+                if (TYPEOF(value) == PROMSXP) {
+                    if (PRVALUE(value) == R_UnboundValue) {
+                        info.type = "promise";
+                        return info;
+                    }
+                    value = PRVALUE(value);
+                }
+
+                int type = TYPEOF(value);
+                info.type = Rf_type2char(type);
+
+                if (type == CLOSXP) {
+                    picojson::array formals;
+                    for (SEXP formal = FORMALS(value); formal != R_NilValue; formal = CDR(formal)) {
+                        formals.push_back(picojson::value(Rchar_to_utf8(R_CHAR(PRINTNAME(TAG(formal))))));
+                    }
+                    info.formals = picojson::value(std::move(formals));
+                }
+
+                return info;
+            }
+
+            // Indexes all bindings in env, or, if it's a namespace, only those that it exports. Errors are reported
+            // via Rf_error.
+            env_index_ptr index_env(SEXP env, const std::string& name, bool is_namespace) {
+                static SEXP namespace_info_symbol = Rf_install(".__NAMESPACE__.");
+                static SEXP exports_symbol = Rf_install("exports");
+
+                // Exports map exported names to names of the bindings in the namespace, which are usually the same,
+                // but may differ if the package renamed something on export. The base namespace has no exports, but
+                // everything in it is exported.
+                SEXP exports = R_NilValue;
+                if (is_namespace) {
+                    SEXP info = Rf_findVarInFrame(env, namespace_info_symbol);
+                    if (TYPEOF(info) == ENVSXP) {
+                        exports = Rf_findVarInFrame(info, exports_symbol);
+                        if (TYPEOF(exports) != ENVSXP) {
+                            exports = R_NilValue;
+                        }
+                    }
+                }
+
+                auto index = std::make_shared<env_index>();
+                index->name = name;
+
+                protected_sexp names(R_lsInternal3(exports != R_NilValue ? exports : env, R_TRUE, R_FALSE));
+                R_xlen_t count = Rf_xlength(names.get());
+                index->symbols.reserve(count);
+
+                for (R_xlen_t i = 0; i < count; ++i) {
+                    SEXP sym = Rf_installChar(STRING_ELT(names.get(), i));
+                    SEXP bound_sym = sym;
+                    if (exports != R_NilValue) {
+                        SEXP internal_name = Rf_findVarInFrame(exports, sym);
+                        if (TYPEOF(internal_name) == STRSXP && Rf_xlength(internal_name) == 1) {
+                            bound_sym = Rf_installChar(STRING_ELT(internal_name, 0));
+                        }
+                    }
+
+                    auto info = describe_symbol(env, bound_sym);
+                    info.name = Rchar_to_utf8(R_CHAR(PRINTNAME(sym)));
+                    index->symbols.push_back(std::move(info));
+                }
+
+                std::sort(index->symbols.begin(), index->symbols.end(), [](const symbol_info& x, const symbol_info& y) {
+                    return x.name < y.name;
+                });
+
+                return index;
+            }
+
+            // Same as the corresponding element of search().
+            std::string search_env_name(SEXP env) {
+                static SEXP name_symbol = Rf_install("name");
+
+                if (env == R_BaseEnv) {
+                    return "package:base";
+                }
+
+                SEXP name = Rf_getAttrib(env, name_symbol);
+                if (TYPEOF(name) == STRSXP && Rf_xlength(name) > 0 && STRING_ELT(name, 0) != R_NaString) {
+                    return Rchar_to_utf8(R_CHAR(STRING_ELT(name, 0)));
+                }
+                return std::string();
+            }
+        }
+
+        bool update(std::chrono::steady_clock::time_point deadline) {
+            std::unordered_map<SEXP, indexed_env> current_envs;
+            bool is_complete = true;
+
+            auto get_index = [&](SEXP env, const std::string& name, bool is_namespace) -> env_index_ptr {
+                auto it = indexed_envs.find(env);
+                if (it != indexed_envs.end()) {
+                    auto index = it->second.index;
+                    current_envs.emplace(env, std::move(it->second));
+                    indexed_envs.erase(it);
+                    return index;
+                }
+
+                if (std::chrono::steady_clock::now() >= deadline) {
+                    is_complete = false;
+                    return nullptr;
+                }
+
+                env_index_ptr index;
+                try {
+                    errors_to_exceptions([&] { index = index_env(env, name, is_namespace); });
+                } catch (r_error& err) {
+                    // Don't retry on every update - it will fail the same way until the environment changes.
+                    logf(log_verbosity::normal, "Failed to index symbols in '%s': %s\n", name.c_str(), err.what());
+                    auto empty = std::make_shared<env_index>();
+                    empty->name = name;
+                    index = empty;
+                }
+
+                current_envs.emplace(env, indexed_env{ protected_sexp(env), index });
+                return index;
+            };
+
+            std::vector<env_index_ptr> search_path;
+            for (SEXP env = ENCLOS(R_GlobalEnv); env != R_EmptyEnv; env = ENCLOS(env)) {
+                auto index = get_index(env, search_env_name(env), false);
+                if (index) {
+                    search_path.push_back(index);
+                }
+            }
+
+            std::unordered_map<std::string, env_index_ptr> namespaces;
+            protected_sexp ns_names(R_lsInternal3(R_NamespaceRegistry, R_TRUE, R_FALSE));
+            for (R_xlen_t i = 0, n = Rf_xlength(ns_names.get()); i < n; ++i) {
+                SEXP ns_name = STRING_ELT(ns_names.get(), i);
+                SEXP ns = Rf_findVarInFrame(R_NamespaceRegistry, Rf_installChar(ns_name));
+                if (TYPEOF(ns) != ENVSXP) {
+                    continue;
+                }
+
+                std::string name = Rchar_to_utf8(R_CHAR(ns_name));
+                auto index = get_index(ns, name, true);
+                if (index) {
+                    namespaces[name] = index;
+                }
+            }
+
+            // Whatever is left over was detached or unloaded since the last update.
+            indexed_envs.swap(current_envs);
+
+            {
+                std::lock_guard<std::mutex> lock(index_mutex);
+                search_path_index.swap(search_path);
+                namespace_index.swap(namespaces);
+                is_index_complete = is_complete;
+            }
+
+            return !is_complete;
+        }
+
+        picojson::value query(const std::string& prefix, const std::string* ns, size_t max_count) {
+            std::vector<env_index_ptr> envs;
+            bool is_complete;
+            {
+                std::lock_guard<std::mutex> lock(index_mutex);
+                if (ns) {
+                    auto it = namespace_index.find(*ns);
+                    if (it != namespace_index.end()) {
+                        envs.push_back(it->second);
+                    }
+                } else {
+                    envs = search_path_index;
+                }
+                is_complete = is_index_complete;
+            }
+
+            // Search path is in lookup order, so the first binding seen for any given name shadows the rest.
+            std::unordered_set<std::string> seen;
+            std::vector<std::pair<const symbol_info*, const env_index*>> matches;
+            for (const auto& env : envs) {
+                auto it = std::lower_bound(env->symbols.begin(), env->symbols.end(), prefix, [](const symbol_info& info, const std::string& prefix) {
+                    return info.name < prefix;
+                });
+                for (; it != env->symbols.end() && !it->name.compare(0, prefix.size(), prefix); ++it) {
+                    if (seen.insert(it->name).second) {
+                        matches.emplace_back(&*it, env.get());
+                    }
+                }
+            }
+
+            std::sort(matches.begin(), matches.end(), [](const std::pair<const symbol_info*, const env_index*>& x, const std::pair<const symbol_info*, const env_index*>& y) {
+                return x.first->name < y.first->name;
+            });
+            if (matches.size() > max_count) {
+                matches.resize(max_count);
+            }
+
+            picojson::array items;
+            items.reserve(matches.size());
+            for (const auto& match : matches) {
+                items.push_back(picojson::value(picojson::array{
+                    picojson::value(match.first->name),
+                    picojson::value(match.second->name),
+                    picojson::value(match.first->type),
+                    match.first->formals
+                }));
+            }
+
+            return picojson::value(picojson::array{ picojson::value(std::move(items)), picojson::value(is_complete) });
+        }
+    }
+}
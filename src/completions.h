@@ -0,0 +1,53 @@
+/* ****************************************************************************
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved. 
+ *
+ *
+ * This file is part of Microsoft R Host.
+ * 
+ * Microsoft R Host is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Microsoft R Host is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***************************************************************************/
+
+
+#pragma once
+#include "stdafx.h"
+
+namespace rhost {
+    namespace completions {
+        // Brings the symbol index up to date with the current search path and the set of loaded namespaces. Only
+        // environments that weren't indexed before are indexed, and those that are gone are dropped, so this is cheap
+        // when nothing was attached or loaded since the last call. Indexing stops once deadline passes; returns true
+        // if there's still more to index, in which case it should be called again.
+        //
+        // Nothing is evaluated to index an environment. Unforced promises - which is how lazy-loaded package functions
+        // look until they're first used - are indexed with type "promise" and no formals, since forcing them would load
+        // every function in every namespace into memory. Active bindings have type "active".
+        //
+        // Must be called on the R thread.
+        bool update(std::chrono::steady_clock::time_point deadline);
+
+        // Finds symbols whose names start with prefix, in ascending order of names, up to max_count of them. If ns is
+        // null, symbols are looked up in the search path (excluding the global environment), and only the first
+        // binding of every name is reported. Otherwise, it's the name of a namespace, and its exports are looked up.
+        //
+        // Returns [items, is_complete], where every item is [name, env, type, formals]: env is the name of the
+        // environment where the symbol is bound, such as "package:stats"; type is typeof() of its value; and formals
+        // are the names of the arguments of a closure, or null for anything else. is_complete is false if the index
+        // is still being built, and so results may be missing.
+        //
+        // Can be called from any thread; never calls into R.
+        picojson::value query(const std::string& prefix, const std::string* ns, size_t max_count);
+    }
+}
@@ -22,13 +22,123 @@
 
 #include "eval.h"
 
+using namespace rhost::util;
+
 namespace rhost {
     namespace eval {
         bool was_eval_canceled;
 
-        void interrupt_eval() {
-            was_eval_canceled = true;
-            Rf_onintr();
+        namespace {
+            // Maximum number of distinct expressions kept in the parse cache.
+            const size_t parse_cache_capacity = 256;
+
+            // Expressions longer than this are assumed to be one-off code (e.g. a sourced file), and are not cached.
+            const size_t parse_cache_max_expr_size = 0x10000;
+
+            struct parse_cache_entry {
+                protected_sexp parsed;
+                bool is_compiled;
+            };
+
+            // Most recently used entries are at the front; map values point into the list.
+            typedef std::list<std::pair<std::string, parse_cache_entry>> parse_cache_list;
+            parse_cache_list parse_cache;
+            std::unordered_map<std::string, parse_cache_list::iterator> parse_cache_index;
+            parse_cache_stats parse_cache_counters;
+
+            protected_sexp parse_uncached(const std::string& expr, ParseStatus& parse_status) {
+                protected_sexp sexp_expr(Rf_allocVector3(STRSXP, 1, nullptr));
+                SET_STRING_ELT(sexp_expr.get(), 0, Rf_mkChar(expr.c_str()));
+                return protected_sexp(R_ParseVector(sexp_expr.get(), -1, &parse_status, R_NilValue));
+            }
+
+            // Byte-compiles every expression in an EXPRSXP, and returns a new EXPRSXP with the compiled code.
+            // Inlining is disabled (optimize = 0), because the compiled code is cached and can be evaluated long
+            // after it was compiled, by which time the user might have redefined any function that would have
+            // been inlined. If compilation fails for any reason, the original parsed expressions are returned.
+            protected_sexp compile(SEXP parsed) {
+                static protected_sexp compile_fn;
+                if (!compile_fn) {
+                    ParseStatus ps;
+                    auto fn_parsed = parse_uncached(
+                        "function(exprs) as.expression(lapply(exprs, compiler::compile, options = list(optimize = 0L)))", ps);
+                    if (ps != PARSE_OK || !r_top_level_exec([&] {
+                        compile_fn = Rf_eval(VECTOR_ELT(fn_parsed.get(), 0), R_BaseEnv);
+                    }, __FUNCTION__)) {
+                        return protected_sexp(parsed);
+                    }
+                }
+
+                protected_sexp call(Rf_allocList(2));
+                SET_TYPEOF(call.get(), LANGSXP);
+                SETCAR(call.get(), compile_fn.get());
+                SETCAR(CDR(call.get()), parsed);
+
+                protected_sexp compiled;
+                if (!r_top_level_exec([&] { compiled = Rf_eval(call.get(), R_BaseEnv); }, __FUNCTION__)) {
+                    return protected_sexp(parsed);
+                }
+
+                ++parse_cache_counters.compiled;
+                return compiled;
+            }
+        }
+
+        protected_sexp r_parse(const std::string& expr, ParseStatus& parse_status, parse_cache_mode mode) {
+            if (mode == parse_cache_mode::bypass || expr.size() > parse_cache_max_expr_size) {
+                return parse_uncached(expr, parse_status);
+            }
+
+            auto it = parse_cache_index.find(expr);
+            if (it != parse_cache_index.end()) {
+                ++parse_cache_counters.hits;
+
+                auto entry = it->second;
+                parse_cache.splice(parse_cache.begin(), parse_cache, entry);
+
+                auto& cached = entry->second;
+                if (mode == parse_cache_mode::hot && !cached.is_compiled) {
+                    cached.parsed = compile(cached.parsed.get());
+                    cached.is_compiled = true;
+                }
+
+                parse_status = PARSE_OK;
+                return cached.parsed;
+            }
+
+            ++parse_cache_counters.misses;
+
+            auto parsed = parse_uncached(expr, parse_status);
+            if (parse_status != PARSE_OK) {
+                return parsed;
+            }
+
+            bool is_compiled = false;
+            if (mode == parse_cache_mode::hot) {
+                parsed = compile(parsed.get());
+                is_compiled = true;
+            }
+
+            if (parse_cache.size() >= parse_cache_capacity) {
+                parse_cache_index.erase(parse_cache.back().first);
+                parse_cache.pop_back();
+            }
+
+            parse_cache.emplace_front(expr, parse_cache_entry{ parsed, is_compiled });
+            parse_cache_index[expr] = parse_cache.begin();
+            return parsed;
+        }
+
+        parse_cache_stats get_parse_cache_stats() {
+            parse_cache_stats stats = parse_cache_counters;
+            stats.size = parse_cache.size();
+            stats.capacity = parse_cache_capacity;
+            return stats;
+        }
+
+        void clear_parse_cache() {
+            parse_cache_index.clear();
+            parse_cache.clear();
         }
     }
 }
@@ -29,6 +29,41 @@ namespace rhost {
     namespace eval {
         extern bool was_eval_canceled;
 
+        // How request_interrupt gets R to notice an interrupt request while it's busy.
+        enum class interrupt_delivery {
+            // Don't; evals are only interrupted when R calls back into the host, which checks the eval stack right
+            // before it interrupts anything. This is the default.
+            callback,
+            // Set R_interrupts_pending directly from the requesting thread, so that R also notices the request in
+            // native code that doesn't call back into the host. R can act on the flag without calling back first
+            // (e.g. at the end of a section where interrupts are suspended), so it might interrupt whatever eval is
+            // running at that point, rather than the one that the request was made for.
+            flag,
+            // Like flag, but set R_interrupts_pending from a signal handler on the R thread. The handler is installed
+            // with SA_RESTART, so most system calls are restarted rather than failing with EINTR; but those that are
+            // never restarted - select, poll, nanosleep and the like, which R waits in (e.g. in Sys.sleep) - return
+            // early, so that R gets to check the flag sooner. Only available on POSIX; falls back to flag elsewhere.
+            signal
+        };
+
+        // Must be called on the R thread before any interrupts are requested.
+        void set_interrupt_delivery(interrupt_delivery delivery);
+
+        // Makes R call Rf_onintr at its next R_CheckUserInterrupt, even if it's in native code that doesn't call
+        // back into the host, unless the delivery is callback, in which case it does nothing. Can be called from any
+        // thread, but calls to it and to retract_interrupt must not overlap.
+        void request_interrupt();
+
+        // Undoes request_interrupt if R hasn't acted on it yet. R_interrupts_pending is only cleared if it was set by
+        // request_interrupt, and not if it was already set when that was called (e.g. by SIGINT). But once it's set,
+        // there's no telling whether a SIGINT arrived later, so one that arrives while the request is pending is merged
+        // with it, as R does for two SIGINTs in a row. Must be called on the R thread.
+        void retract_interrupt();
+
+        // If R has acted on the interrupt request by calling Rf_onintr on its own (rather than via interrupt_eval),
+        // clears the request and returns true. Must be called on the R thread.
+        bool consume_interrupt();
+
         template <class T>
         struct r_eval_result {
             bool has_value;
@@ -38,55 +73,76 @@ namespace rhost {
             bool is_canceled;
         };
 
+        enum class parse_cache_mode {
+            // Parse the expression anew, without consulting or updating the cache.
+            bypass,
+            // Look up the parsed expression in the cache, and add it there if it's not already present.
+            normal,
+            // Same as normal, but also byte-compile the parsed expression when it is added to the cache
+            // (or looked up, if it was cached uncompiled before).
+            hot
+        };
+
+        struct parse_cache_stats {
+            uint64_t hits;
+            uint64_t misses;
+            uint64_t compiled;
+            size_t size;
+            size_t capacity;
+        };
+
+        // Parses expr into an EXPRSXP. Parsed expressions are kept in a bounded LRU cache keyed by the text
+        // of the expression, so that evaluating the same expression repeatedly does not require parsing it
+        // every time. Only successfully parsed expressions are cached. For hot expressions, the cached value
+        // contains byte-compiled code, which is evaluated the same way as the parsed expressions would be.
+        util::protected_sexp r_parse(const std::string& expr, ParseStatus& parse_status, parse_cache_mode mode = parse_cache_mode::bypass);
+
+        parse_cache_stats get_parse_cache_stats();
+
+        void clear_parse_cache();
+
         template <class FBefore, class FAfter>
-        inline std::vector<r_eval_result<util::protected_sexp>> r_try_eval(const std::string& expr, SEXP env, ParseStatus& parse_status, FBefore before = [] {}, FAfter after = [] {}) {
+        inline std::vector<r_eval_result<util::protected_sexp>> r_try_eval(SEXP sexp_parsed, SEXP env, FBefore before, FAfter after) {
             using namespace rhost::util;
 
             std::vector<r_eval_result<protected_sexp>> results;
-
-            protected_sexp sexp_expr(Rf_allocVector3(STRSXP, 1, nullptr));
-            SET_STRING_ELT(sexp_expr.get(), 0, Rf_mkChar(expr.c_str()));
-
-            protected_sexp sexp_parsed(R_ParseVector(sexp_expr.get(), -1, &parse_status, R_NilValue));
-            if (parse_status == PARSE_OK) {
-                results.resize(Rf_length(sexp_parsed.get()));
-                for (size_t i = 0; i < results.size(); ++i) {
-                    auto& result = results[i];
-
-                    struct eval_data_t {
-                        SEXP expr;
-                        SEXP env;
-                        decltype(result)& result_ref;
-                        FBefore& before;
-                        FAfter& after;
-                    } eval_data = { VECTOR_ELT(sexp_parsed.get(), i), env, result, before, after };
-
-                    // Reset debug flag to avoid eval entering Browse mode.
-                    int rdebug = RDEBUG(env);
-                    SET_RDEBUG(env, 0);
-
-                    result.has_error = !rhost::util::r_top_level_exec([&] {
-                        eval_data.before();
-                        was_eval_canceled = false;
-                        eval_data.result_ref.value.reset(Rf_eval(eval_data.expr, eval_data.env));
-                        eval_data.after();
-                    });
-                    result.is_canceled = was_eval_canceled;
+            results.resize(Rf_length(sexp_parsed));
+            for (size_t i = 0; i < results.size(); ++i) {
+                auto& result = results[i];
+
+                struct eval_data_t {
+                    SEXP expr;
+                    SEXP env;
+                    decltype(result)& result_ref;
+                    FBefore& before;
+                    FAfter& after;
+                } eval_data = { VECTOR_ELT(sexp_parsed, i), env, result, before, after };
+
+                // Reset debug flag to avoid eval entering Browse mode.
+                int rdebug = RDEBUG(env);
+                SET_RDEBUG(env, 0);
+
+                result.has_error = !rhost::util::r_top_level_exec([&] {
+                    eval_data.before();
                     was_eval_canceled = false;
+                    eval_data.result_ref.value.reset(Rf_eval(eval_data.expr, eval_data.env));
+                    eval_data.after();
+                });
+                result.is_canceled = was_eval_canceled || (result.has_error && consume_interrupt());
+                was_eval_canceled = false;
 
-                    // Restore debug flag.
-                    SET_RDEBUG(env, rdebug);
+                // Restore debug flag.
+                SET_RDEBUG(env, rdebug);
 
-                    if (result.value) {
-                        result.has_value = true;
-                    }
-                    if (result.has_error) {
-                        if (result.is_canceled) {
-                            // R_curErrorBuf will be bogus in this case.
-                            result.error = "Evaluation canceled.";
-                        } else {
-                            result.error = R_curErrorBuf();
-                        }
+                if (result.value) {
+                    result.has_value = true;
+                }
+                if (result.has_error) {
+                    if (result.is_canceled) {
+                        // R_curErrorBuf will be bogus in this case.
+                        result.error = "Evaluation canceled.";
+                    } else {
+                        result.error = R_curErrorBuf();
                     }
                 }
             }
@@ -94,6 +150,15 @@ namespace rhost {
             return results;
         }
 
+        template <class FBefore, class FAfter>
+        inline std::vector<r_eval_result<util::protected_sexp>> r_try_eval(const std::string& expr, SEXP env, ParseStatus& parse_status, FBefore before, FAfter after, parse_cache_mode cache_mode = parse_cache_mode::bypass) {
+            auto sexp_parsed = r_parse(expr, parse_status, cache_mode);
+            if (parse_status != PARSE_OK) {
+                return std::vector<r_eval_result<util::protected_sexp>>();
+            }
+            return r_try_eval(sexp_parsed.get(), env, before, after);
+        }
+
         template <class FBefore, class FAfter>
         inline r_eval_result<std::string> r_try_eval_str(const std::string& expr, SEXP env, ParseStatus& parse_status, FBefore before, FAfter after) {
             using namespace rhost::util;
@@ -28,6 +28,7 @@
 #include "util.h"
 #include "grdevices.h"
 #include "exports.h"
+#include "stats.h"
 
 using namespace rhost::rapi;
 
@@ -56,6 +57,7 @@ namespace rhost {
                 void render_from_display_list();
                 void render_from_snapshot();
                 void set_snapshot(const rhost::util::protected_sexp& snapshot);
+                bool drop_snapshot();
 
             private:
                 void create_snapshot();
@@ -94,6 +96,7 @@ namespace rhost {
 
                 void resize(double width, double height, double resolution);
                 void render_from_snapshot();
+                size_t drop_inactive_snapshots();
 
                 int plot_count() const;
                 int active_plot_index() const;
@@ -192,6 +195,7 @@ namespace rhost {
                 void output_and_kill_file_device();
 
                 static void process_pending_render(bool immediately);
+                static size_t drop_inactive_snapshots();
                 static ide_device* find_device_by_num(int device_num);
                 static ide_device* find_device_by_id(const boost::uuids::uuid& device_id);
 
@@ -302,8 +306,10 @@ namespace rhost {
 
                 _has_pending_render = false;
 
+                auto start = std::chrono::steady_clock::now();
                 auto xdd = reinterpret_cast<ide_device*>(_device_desc->deviceSpecific);
                 auto path = xdd->save();
+                stats::plot_render_time.record(std::chrono::steady_clock::now() - start);
 
                 remove_snapshot_render_file();
 
@@ -366,6 +372,16 @@ namespace rhost {
                 });
             }
 
+            template <int ApiVer>
+            bool plot<ApiVer>::drop_snapshot() {
+                if (_snapshot.get() == nullptr) {
+                    return false;
+                }
+
+                _snapshot = nullptr;
+                return true;
+            }
+
             template <int ApiVer>
             void plot<ApiVer>::create_snapshot() {
                 rhost::util::errors_to_exceptions([&] {
@@ -500,6 +516,19 @@ namespace rhost {
                 }
             }
 
+            // Snapshots of plots other than the active one are only needed to re-render them if they're selected again,
+            // so they're the first thing to go when memory is running low. Such plots are then rendered empty.
+            template <int ApiVer>
+            size_t plot_history<ApiVer>::drop_inactive_snapshots() {
+                size_t count = 0;
+                for (auto it = _plots.begin(); it != _plots.end(); ++it) {
+                    if (it != _active_plot && (*it)->drop_snapshot()) {
+                        ++count;
+                    }
+                }
+                return count;
+            }
+
             template <int ApiVer>
             int plot_history<ApiVer>::plot_count() const {
                 return (int)_plots.size();
@@ -1134,6 +1163,15 @@ namespace rhost {
                 }
             }
 
+            template <int ApiVer>
+            size_t ide_device<ApiVer>::drop_inactive_snapshots() {
+                size_t count = 0;
+                for (auto dev : devices) {
+                    count += dev->_history.drop_inactive_snapshots();
+                }
+                return count;
+            }
+
             template <int ApiVer>
             auto ide_device<ApiVer>::find_device_by_num(int device_num) -> ide_device* {
                 auto dev = find_if(devices.begin(), devices.end(), [&](auto& d) {
@@ -1464,6 +1502,12 @@ namespace rhost {
                 {}
             };
 
+            static size_t (*drop_inactive_snapshots_impl)() = nullptr;
+
+            size_t drop_inactive_snapshots() {
+                return drop_inactive_snapshots_impl ? drop_inactive_snapshots_impl() : 0;
+            }
+
             void init(DllInfo *dll) {
                 R_ExternalMethodDef* external_methods;
                 void (*process_pending_render)(bool immediately);
@@ -1472,14 +1516,17 @@ namespace rhost {
                 case 10:
                     external_methods = external_methods_impl<10>::external_methods;
                     process_pending_render = ide_device<10>::process_pending_render;
+                    drop_inactive_snapshots_impl = ide_device<10>::drop_inactive_snapshots;
                     break;
                 case 11:
                     external_methods = external_methods_impl<11>::external_methods;
                     process_pending_render = ide_device<11>::process_pending_render;
+                    drop_inactive_snapshots_impl = ide_device<11>::drop_inactive_snapshots;
                     break;
                 case 12:
                     external_methods = external_methods_impl<12>::external_methods;
                     process_pending_render = ide_device<12>::process_pending_render;
+                    drop_inactive_snapshots_impl = ide_device<12>::drop_inactive_snapshots;
                     break;
                 default:
                     log::fatal_error("Unsupported GD API version %d", ver);
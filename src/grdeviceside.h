@@ -29,6 +29,10 @@ namespace rhost {
     namespace grdevices {
         namespace ide {
             void init(DllInfo *dll);
+
+            // Drops the snapshots of all plots in the history of every IDE device, other than the active plots, and
+            // returns how many were dropped. Must be called on the R thread.
+            size_t drop_inactive_snapshots();
         }
     }
 }
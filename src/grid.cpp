@@ -0,0 +1,737 @@
+/* ****************************************************************************
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved. 
+ *
+ *
+ * This file is part of Microsoft R Host.
+ * 
+ * Microsoft R Host is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Microsoft R Host is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***************************************************************************/
+
+
+#include "stdafx.h"
+#include "grid.h"
+#include "gridview.h"
+#include "colstats.h"
+#include "util.h"
+
+using namespace rhost::util;
+
+namespace rhost {
+    namespace grid {
+        namespace {
+            const size_t max_pinned = 64;
+
+            struct pinned_object {
+                protected_sexp obj;
+
+                // Rows of obj in the order they're viewed, if it has been sorted or filtered.
+                bool has_view;
+                std::vector<size_t> view;
+            };
+
+            uint64_t next_pin_id = 1;
+            std::map<uint64_t, pinned_object> pinned;
+
+            bool inherits(SEXP klass, const char* name) {
+                if (TYPEOF(klass) != STRSXP) {
+                    return false;
+                }
+                for (R_xlen_t i = 0; i < Rf_xlength(klass); ++i) {
+                    if (!strcmp(R_CHAR(STRING_ELT(klass, i)), name)) {
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            // Looks up an attribute without going through Rf_getAttrib, which expands compact row names.
+            SEXP raw_attrib(SEXP sexp, SEXP name) {
+                for (SEXP a = ATTRIB(sexp); a != R_NilValue; a = CDR(a)) {
+                    if (TAG(a) == name) {
+                        return CAR(a);
+                    }
+                }
+                return R_NilValue;
+            }
+
+            bool is_atomic(int type) {
+                switch (type) {
+                case LGLSXP:
+                case INTSXP:
+                case REALSXP:
+                case CPLXSXP:
+                case STRSXP:
+                case RAWSXP:
+                    return true;
+                default:
+                    return false;
+                }
+            }
+
+            // How an object is laid out as a table.
+            struct table {
+                enum { frame, matrix, vector } shape;
+                SEXP obj;
+                size_t nrow, ncol;
+                SEXP row_names, col_names;
+
+                // Where the cells of column j are: in x, starting at x_start.
+                void get_column(size_t j, SEXP& x, SEXP& klass, R_xlen_t& x_start) const {
+                    switch (shape) {
+                    case frame:
+                        x = VECTOR_ELT(obj, j);
+                        klass = Rf_getAttrib(x, R_ClassSymbol);
+                        x_start = 0;
+                        break;
+                    case matrix:
+                        x = obj;
+                        klass = R_NilValue;
+                        x_start = static_cast<R_xlen_t>(j * nrow);
+                        break;
+                    case vector:
+                        x = obj;
+                        klass = Rf_getAttrib(obj, R_ClassSymbol);
+                        x_start = 0;
+                        break;
+                    }
+                }
+
+                // Whether column j can be represented as a single column of cells; matrix and data frame columns
+                // of data frames can't.
+                bool is_simple_column(size_t j) const {
+                    if (shape != frame) {
+                        return true;
+                    }
+                    SEXP col = VECTOR_ELT(obj, j);
+                    return Rf_xlength(col) >= static_cast<R_xlen_t>(nrow) && Rf_getAttrib(col, R_DimSymbol) == R_NilValue;
+                }
+            };
+
+            bool get_table(SEXP obj, table& t) {
+                SEXP klass = Rf_getAttrib(obj, R_ClassSymbol);
+                SEXP dims = Rf_getAttrib(obj, R_DimSymbol);
+                t.obj = obj;
+
+                if (TYPEOF(obj) == VECSXP && inherits(klass, "data.frame")) {
+                    t.shape = table::frame;
+                    t.ncol = Rf_xlength(obj);
+                    t.col_names = Rf_getAttrib(obj, R_NamesSymbol);
+
+                    // Row names are usually stored in compact form c(NA, -nrow) or c(NA, nrow).
+                    t.row_names = raw_attrib(obj, R_RowNamesSymbol);
+                    if (TYPEOF(t.row_names) == INTSXP && Rf_xlength(t.row_names) == 2 && INTEGER(t.row_names)[0] == R_NaInt) {
+                        t.nrow = std::abs(INTEGER(t.row_names)[1]);
+                        t.row_names = R_NilValue;
+                    } else {
+                        t.nrow = Rf_xlength(t.row_names);
+                    }
+                } else if (is_atomic(TYPEOF(obj)) && TYPEOF(dims) == INTSXP && Rf_xlength(dims) == 2) {
+                    t.shape = table::matrix;
+                    t.nrow = INTEGER(dims)[0];
+                    t.ncol = INTEGER(dims)[1];
+                    SEXP dimnames = Rf_getAttrib(obj, R_DimNamesSymbol);
+                    t.row_names = TYPEOF(dimnames) == VECSXP ? VECTOR_ELT(dimnames, 0) : R_NilValue;
+                    t.col_names = TYPEOF(dimnames) == VECSXP ? VECTOR_ELT(dimnames, 1) : R_NilValue;
+                } else if (is_atomic(TYPEOF(obj)) && dims == R_NilValue) {
+                    t.shape = table::vector;
+                    t.nrow = Rf_xlength(obj);
+                    t.ncol = 1;
+                    t.row_names = Rf_getAttrib(obj, R_NamesSymbol);
+                    t.col_names = R_NilValue;
+                } else {
+                    return false;
+                }
+
+                return true;
+            }
+
+            // Rows in a window: either consecutive rows from start onward, or else rows at positions from start onward
+            // in the view of the object.
+            struct row_window {
+                const std::vector<size_t>* view;
+                size_t start, count;
+
+                R_xlen_t operator[] (size_t i) const {
+                    return static_cast<R_xlen_t>(view ? (*view)[start + i] : start + i);
+                }
+            };
+
+            picojson::value utf8_json(SEXP charsxp) {
+                return charsxp == R_NaString ? picojson::value() : picojson::value(std::string(Rf_translateCharUTF8(charsxp)));
+            }
+
+            picojson::value class_to_json(SEXP klass) {
+                if (TYPEOF(klass) != STRSXP) {
+                    return picojson::value();
+                }
+
+                picojson::array result;
+                for (R_xlen_t i = 0; i < Rf_xlength(klass); ++i) {
+                    result.push_back(utf8_json(STRING_ELT(klass, i)));
+                }
+                return picojson::value(std::move(result));
+            }
+
+            picojson::value row_names_to_json(SEXP row_names, const row_window& rows) {
+                picojson::array names;
+                if (TYPEOF(row_names) == STRSXP) {
+                    for (size_t i = 0; i < rows.count; ++i) {
+                        names.push_back(utf8_json(STRING_ELT(row_names, rows[i])));
+                    }
+                } else if (TYPEOF(row_names) == INTSXP) {
+                    for (size_t i = 0; i < rows.count; ++i) {
+                        int name = INTEGER(row_names)[rows[i]];
+                        names.push_back(name == R_NaInt ? picojson::value() : picojson::value(std::to_string(name)));
+                    }
+                } else if (rows.view) {
+                    // Rows are no longer numbered consecutively, so tell the client what their numbers are.
+                    for (size_t i = 0; i < rows.count; ++i) {
+                        names.push_back(picojson::value(std::to_string(rows[i] + 1)));
+                    }
+                } else {
+                    return picojson::value();
+                }
+                return picojson::value(std::move(names));
+            }
+
+            template <class T>
+            T* append_uninitialized(blobs::blob& data, size_t count) {
+                size_t pos = data.size();
+                data.resize(pos + count * sizeof(T));
+                return reinterpret_cast<T*>(&data[pos]);
+            }
+
+            // Reads cells via get_region (one of *_GET_REGION) if R has it, so that ALTREP vectors (R 3.5+) are not
+            // expanded. Older versions of R don't have ALTREP, so reading via get_data (INTEGER etc) is just as good.
+            template <class T>
+            T* write_numbers(SEXP x, R_xlen_t x_start, const row_window& rows, T* (*get_data)(SEXP),
+                R_xlen_t (*get_region)(SEXP, R_xlen_t, R_xlen_t, T*), blobs::blob& data) {
+                T* values = append_uninitialized<T>(data, rows.count);
+                if (get_region) {
+                    if (!rows.view) {
+                        get_region(x, x_start + rows.start, rows.count, values);
+                    } else {
+                        for (size_t i = 0; i < rows.count; ++i) {
+                            get_region(x, x_start + rows[i], 1, &values[i]);
+                        }
+                    }
+                } else {
+                    const T* cells = get_data(x) + x_start;
+                    if (!rows.view) {
+                        memcpy(values, cells + rows.start, rows.count * sizeof(T));
+                    } else {
+                        for (size_t i = 0; i < rows.count; ++i) {
+                            values[i] = cells[rows[i]];
+                        }
+                    }
+                }
+                return values;
+            }
+
+            void write_strings(SEXP strings, R_xlen_t x_start, const row_window& rows, const fetch_options& options, blobs::blob& data, picojson::value& na) {
+                // Strings may be translated into memory allocated by R_alloc, which is only released here.
+                const void* vmax = vmaxget();
+
+                std::vector<uint32_t> offsets;
+                offsets.reserve(rows.count + 1);
+                offsets.push_back(0);
+
+                size_t offsets_pos = data.size();
+                append_uninitialized<uint32_t>(data, rows.count + 1);
+                size_t text_pos = data.size();
+
+                picojson::array na_indices;
+                for (size_t i = 0; i < rows.count; ++i) {
+                    SEXP s = STRING_ELT(strings, x_start + rows[i]);
+                    if (s == R_NaString) {
+                        na_indices.push_back(picojson::value(static_cast<double>(i)));
+                    } else {
+                        const char* u8s = Rf_translateCharUTF8(s);
+                        size_t len = strlen(u8s);
+                        if (len > options.max_string_length) {
+                            len = options.max_string_length;
+                            while (len > 0 && (u8s[len] & 0xC0) == 0x80) {
+                                --len;
+                            }
+                        }
+                        data.insert(data.end(), u8s, u8s + len);
+                    }
+                    offsets.push_back(static_cast<uint32_t>(data.size() - text_pos));
+                }
+
+                memcpy(&data[offsets_pos], offsets.data(), offsets.size() * sizeof(uint32_t));
+                vmaxset(vmax);
+
+                if (!na_indices.empty()) {
+                    na = picojson::value(std::move(na_indices));
+                }
+            }
+
+            void write_factor(SEXP codes, SEXP levels, R_xlen_t x_start, const row_window& rows, blobs::blob& data, picojson::value& levels_json) {
+                int* window_codes = write_numbers<int>(codes, x_start, rows, INTEGER, INTEGER_GET_REGION, data);
+
+                R_xlen_t level_count = TYPEOF(levels) == STRSXP ? Rf_xlength(levels) : 0;
+                std::unordered_map<int, int> window_levels;
+                picojson::array window_levels_json;
+                for (size_t i = 0; i < rows.count; ++i) {
+                    int& code = window_codes[i];
+                    if (code == R_NaInt || code < 1 || code > level_count) {
+                        code = R_NaInt;
+                        continue;
+                    }
+
+                    auto it = window_levels.find(code);
+                    if (it == window_levels.end()) {
+                        window_levels_json.push_back(utf8_json(STRING_ELT(levels, code - 1)));
+                        it = window_levels.emplace(code, static_cast<int>(window_levels.size() + 1)).first;
+                    }
+                    code = it->second;
+                }
+
+                levels_json = picojson::value(std::move(window_levels_json));
+            }
+
+            // Writes format(x[indices]) as strings. This is done via PROTECT rather than protected_sexp, so that
+            // nothing is leaked if either function raises an error.
+            void write_formatted(SEXP x, R_xlen_t x_start, const row_window& rows, const fetch_options& options, blobs::blob& data, picojson::value& na) {
+                static SEXP subset_symbol = Rf_install("[");
+                static SEXP format_symbol = Rf_install("format");
+
+                SEXP indices = Rf_protect(Rf_allocVector(REALSXP, rows.count));
+                for (size_t i = 0; i < rows.count; ++i) {
+                    REAL(indices)[i] = static_cast<double>(x_start + rows[i] + 1);
+                }
+
+                SEXP subset = Rf_protect(Rf_eval(Rf_protect(Rf_lang3(subset_symbol, x, indices)), R_BaseEnv));
+                SEXP formatted = Rf_protect(Rf_eval(Rf_protect(Rf_lang2(format_symbol, subset)), R_BaseEnv));
+                if (TYPEOF(formatted) != STRSXP || Rf_xlength(formatted) != static_cast<R_xlen_t>(rows.count)) {
+                    Rf_error("format() did not produce a character vector of the same length as its input.");
+                }
+
+                write_strings(formatted, 0, row_window{ nullptr, 0, rows.count }, options, data, na);
+                Rf_unprotect(5);
+            }
+
+            picojson::value write_column(picojson::value name, SEXP x, SEXP klass, R_xlen_t x_start, const row_window& rows,
+                const fetch_options& options, blobs::blob& data) {
+                data.resize((data.size() + 7) & ~size_t(7));
+                size_t offset = data.size();
+
+                picojson::value levels, na;
+                const char* type;
+
+                int x_type = TYPEOF(x);
+                bool is_factor = x_type == INTSXP && inherits(klass, "factor");
+                bool format = x_type != LGLSXP && x_type != INTSXP && x_type != REALSXP && x_type != STRSXP;
+                if (klass != R_NilValue && !is_factor && options.format_classed) {
+                    format = true;
+                }
+
+                if (is_factor) {
+                    type = "factor";
+                    write_factor(x, Rf_getAttrib(x, R_LevelsSymbol), x_start, rows, data, levels);
+                } else if (format) {
+                    type = "string";
+                    write_formatted(x, x_start, rows, options, data, na);
+                } else {
+                    switch (x_type) {
+                    case REALSXP:
+                        type = "double";
+                        write_numbers<double>(x, x_start, rows, REAL, REAL_GET_REGION, data);
+                        break;
+                    case INTSXP:
+                        type = "integer";
+                        write_numbers<int>(x, x_start, rows, INTEGER, INTEGER_GET_REGION, data);
+                        break;
+                    case LGLSXP:
+                        type = "logical";
+                        write_numbers<int>(x, x_start, rows, LOGICAL, LOGICAL_GET_REGION, data);
+                        break;
+                    default:
+                        type = "string";
+                        write_strings(x, x_start, rows, options, data, na);
+                        break;
+                    }
+                }
+
+                return picojson::value(picojson::array{
+                    name,
+                    picojson::value(type),
+                    class_to_json(klass),
+                    picojson::value(static_cast<double>(offset)),
+                    picojson::value(static_cast<double>(data.size() - offset)),
+                    levels,
+                    na
+                });
+            }
+
+            // Gathers cells of a column for gridview kernels, which need every cell anyway, as a plain array that worker
+            // threads can read without calling into R. Unlike write_numbers, this goes through REAL, INTEGER and LOGICAL,
+            // so ALTREP vectors (e.g. compact sequences) are expanded in memory. Strings are gathered as they are stored,
+            // i.e. in the native encoding unless marked otherwise, with no translation.
+            bool gather_column(SEXP x, R_xlen_t x_start, size_t nrow, gridview::column& col) {
+                switch (TYPEOF(x)) {
+                case REALSXP:
+                    col.kind = gridview::column::real;
+                    col.reals = REAL(x) + x_start;
+                    return true;
+                case INTSXP:
+                    col.kind = gridview::column::integer;
+                    col.integers = INTEGER(x) + x_start;
+                    return true;
+                case LGLSXP:
+                    col.kind = gridview::column::integer;
+                    col.integers = LOGICAL(x) + x_start;
+                    return true;
+                case STRSXP:
+                    col.kind = gridview::column::string;
+                    col.strings.resize(nrow);
+                    for (size_t i = 0; i < nrow; ++i) {
+                        SEXP s = STRING_ELT(x, x_start + i);
+                        col.strings[i] = s == R_NaString ? nullptr : R_CHAR(s);
+                    }
+                    return true;
+                default:
+                    return false;
+                }
+            }
+
+            bool parse_filter_op(const std::string& op, gridview::filter::op_t& result) {
+                static const std::pair<const char*, gridview::filter::op_t> ops[] = {
+                    { "==", gridview::filter::eq },
+                    { "!=", gridview::filter::ne },
+                    { "<", gridview::filter::lt },
+                    { "<=", gridview::filter::le },
+                    { ">", gridview::filter::gt },
+                    { ">=", gridview::filter::ge },
+                    { "contains", gridview::filter::contains },
+                    { "is_na", gridview::filter::is_na },
+                    { "not_na", gridview::filter::not_na },
+                };
+
+                for (const auto& entry : ops) {
+                    if (op == entry.first) {
+                        result = entry.second;
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            // Whether a factor level matches a filter, which is applied to the level labels.
+            bool level_matches(const gridview::filter& f, const std::string& level) {
+                if (f.op == gridview::filter::contains) {
+                    return level.find(f.text) != std::string::npos;
+                }
+
+                int cmp = level.compare(f.text);
+                switch (f.op) {
+                case gridview::filter::eq:
+                    return cmp == 0;
+                case gridview::filter::ne:
+                    return cmp != 0;
+                case gridview::filter::lt:
+                    return cmp < 0;
+                case gridview::filter::le:
+                    return cmp <= 0;
+                case gridview::filter::gt:
+                    return cmp > 0;
+                case gridview::filter::ge:
+                    return cmp >= 0;
+                default:
+                    return false;
+                }
+            }
+        }
+
+        picojson::value fetch(uint64_t pin, size_t row_start, size_t row_count, size_t col_start, size_t col_count,
+            const fetch_options& options, blobs::blob& data) {
+            auto& po = pinned.at(pin);
+
+            table t;
+            if (!get_table(po.obj.get(), t)) {
+                Rf_error("Object must be a data frame, a matrix, or an atomic vector.");
+            }
+
+            size_t nrow = po.has_view ? po.view.size() : t.nrow;
+            row_start = std::min(row_start, nrow);
+            row_count = std::min(row_count, nrow - row_start);
+            col_start = std::min(col_start, t.ncol);
+            col_count = std::min(col_count, t.ncol - col_start);
+
+            row_window rows{ po.has_view ? &po.view : nullptr, row_start, row_count };
+
+            picojson::array columns;
+            for (size_t j = col_start; j < col_start + col_count; ++j) {
+                picojson::value name = TYPEOF(t.col_names) == STRSXP ? utf8_json(STRING_ELT(t.col_names, j)) : picojson::value();
+
+                SEXP x, klass;
+                R_xlen_t x_start;
+                t.get_column(j, x, klass, x_start);
+
+                if (!t.is_simple_column(j)) {
+                    columns.push_back(picojson::value(picojson::array{
+                        name, picojson::value("unsupported"), class_to_json(klass),
+                        picojson::value(static_cast<double>(data.size())), picojson::value(0.0), picojson::value(), picojson::value()
+                    }));
+                    continue;
+                }
+
+                columns.push_back(write_column(name, x, klass, x_start, rows, options, data));
+            }
+
+            return picojson::value(picojson::array{
+                picojson::value(static_cast<double>(nrow)),
+                picojson::value(static_cast<double>(t.ncol)),
+                row_names_to_json(t.row_names, rows),
+                picojson::value(std::move(columns))
+            });
+        }
+
+        bool set_view(uint64_t pin, const std::vector<sort_spec>& sort, const std::vector<filter_spec>& filters, size_t& nrow, std::string& error) {
+            auto& po = pinned.at(pin);
+
+            table t;
+            if (!get_table(po.obj.get(), t)) {
+                error = "Object must be a data frame, a matrix, or an atomic vector.";
+                return false;
+            }
+
+            if (sort.empty() && filters.empty()) {
+                po.has_view = false;
+                po.view = std::vector<size_t>();
+                nrow = t.nrow;
+                return true;
+            }
+
+            // Only gather the columns that are actually used, and refer to them by their position in columns.
+            std::vector<gridview::column> columns;
+            std::unordered_map<size_t, size_t> column_slots;
+            auto get_slot = [&](size_t j, size_t& slot) {
+                auto it = column_slots.find(j);
+                if (it != column_slots.end()) {
+                    slot = it->second;
+                    return true;
+                }
+
+                if (j >= t.ncol || !t.is_simple_column(j)) {
+                    error = "Column " + std::to_string(j) + " can't be sorted or filtered on.";
+                    return false;
+                }
+
+                SEXP x, klass;
+                R_xlen_t x_start;
+                t.get_column(j, x, klass, x_start);
+
+                gridview::column col;
+                if (!gather_column(x, x_start, t.nrow, col)) {
+                    error = "Column " + std::to_string(j) + " can't be sorted or filtered on.";
+                    return false;
+                }
+
+                slot = columns.size();
+                columns.push_back(std::move(col));
+                column_slots.emplace(j, slot);
+                return true;
+            };
+
+            std::vector<gridview::sort_key> keys;
+            for (const auto& spec : sort) {
+                gridview::sort_key key;
+                if (!get_slot(spec.column, key.column)) {
+                    return false;
+                }
+                key.descending = spec.descending;
+                keys.push_back(key);
+            }
+
+            std::vector<gridview::filter> view_filters;
+            for (const auto& spec : filters) {
+                gridview::filter f;
+                if (!parse_filter_op(spec.op, f.op)) {
+                    error = "Unknown filter operator '" + spec.op + "'.";
+                    return false;
+                }
+                if (!get_slot(spec.column, f.column)) {
+                    return false;
+                }
+
+                if (f.op != gridview::filter::is_na && f.op != gridview::filter::not_na) {
+                    SEXP x, klass;
+                    R_xlen_t x_start;
+                    t.get_column(spec.column, x, klass, x_start);
+
+                    const auto& col = columns[f.column];
+                    if (col.kind == gridview::column::integer && inherits(klass, "factor")) {
+                        // Levels are matched against the filter up front, and rows are then filtered by their codes.
+                        if (!spec.operand.is<std::string>()) {
+                            error = "Factor columns must be filtered by string.";
+                            return false;
+                        }
+                        f.text = spec.operand.get<std::string>();
+
+                        SEXP levels = Rf_getAttrib(x, R_LevelsSymbol);
+                        R_xlen_t level_count = TYPEOF(levels) == STRSXP ? Rf_xlength(levels) : 0;
+                        f.set.resize(level_count + 1);
+                        for (R_xlen_t i = 0; i < level_count; ++i) {
+                            SEXP level = STRING_ELT(levels, i);
+                            f.set[i + 1] = level != R_NaString && level_matches(f, Rf_translateCharUTF8(level));
+                        }
+                        f.op = gridview::filter::in_set;
+                    } else if (col.kind == gridview::column::string) {
+                        if (!spec.operand.is<std::string>()) {
+                            error = "String columns must be filtered by string.";
+                            return false;
+                        }
+                        f.text = from_utf8(spec.operand.get<std::string>());
+                    } else {
+                        if (!spec.operand.is<double>() || f.op == gridview::filter::contains) {
+                            error = "Numeric columns must be filtered by comparison with a number.";
+                            return false;
+                        }
+                        f.number = spec.operand.get<double>();
+                    }
+                }
+
+                view_filters.push_back(std::move(f));
+            }
+
+            po.view = gridview::build_view(columns, t.nrow, view_filters, keys, std::max(1U, std::thread::hardware_concurrency()));
+            po.has_view = true;
+            nrow = po.view.size();
+            return true;
+        }
+
+        bool summarize_columns(uint64_t pin, const std::vector<size_t>* columns, size_t bins, const std::atomic<bool>& canceled,
+            picojson::value& result, std::string& error) {
+            auto& po = pinned.at(pin);
+
+            table t;
+            if (!get_table(po.obj.get(), t)) {
+                error = "Object must be a data frame, a matrix, or an atomic vector.";
+                return false;
+            }
+
+            std::vector<size_t> all_columns;
+            if (!columns) {
+                all_columns.resize(t.ncol);
+                std::iota(all_columns.begin(), all_columns.end(), size_t(0));
+                columns = &all_columns;
+            }
+
+            // Columns that can't be summarized are reported with null statistics.
+            std::vector<size_t> summarized;
+            std::vector<gridview::column> gathered;
+            for (size_t j : *columns) {
+                if (j >= t.ncol) {
+                    error = "Column " + std::to_string(j) + " does not exist.";
+                    return false;
+                }
+                if (!t.is_simple_column(j)) {
+                    continue;
+                }
+
+                SEXP x, klass;
+                R_xlen_t x_start;
+                t.get_column(j, x, klass, x_start);
+
+                gridview::column col;
+                if (gather_column(x, x_start, t.nrow, col)) {
+                    summarized.push_back(j);
+                    gathered.push_back(std::move(col));
+                }
+            }
+
+            std::vector<colstats::summary> summaries;
+            if (!colstats::summarize(gathered, t.nrow, bins, std::max(1U, std::thread::hardware_concurrency()), canceled, summaries)) {
+                error = "CANCELED";
+                return false;
+            }
+
+            auto number = [](double x) {
+                return std::isnan(x) ? picojson::value() : picojson::value(x);
+            };
+
+            picojson::array items;
+            for (size_t j : *columns) {
+                picojson::array item{ picojson::value(static_cast<double>(j)) };
+
+                auto it = std::find(summarized.begin(), summarized.end(), j);
+                if (it == summarized.end()) {
+                    item.resize(8);
+                } else {
+                    const auto& s = summaries[it - summarized.begin()];
+                    picojson::array histogram;
+                    for (auto n : s.histogram) {
+                        histogram.push_back(picojson::value(static_cast<double>(n)));
+                    }
+
+                    item.push_back(picojson::value(static_cast<double>(s.count)));
+                    item.push_back(picojson::value(static_cast<double>(s.na_count)));
+                    item.push_back(number(s.min));
+                    item.push_back(number(s.max));
+                    item.push_back(number(s.mean));
+                    item.push_back(picojson::value(std::round(s.distinct)));
+                    item.push_back(picojson::value(std::move(histogram)));
+                }
+
+                items.push_back(picojson::value(std::move(item)));
+            }
+
+            result = picojson::value(std::move(items));
+            return true;
+        }
+
+        uint64_t pin(SEXP obj) {
+            if (pinned.size() >= max_pinned) {
+                pinned.erase(pinned.begin());
+            }
+
+            // The viewer expects the object to stay as it was when pinned, but if the variable it came from is the
+            // only reference that R knows of, R modifies it in place on assignment to an element. Make R copy it
+            // instead. Same as MARK_NOT_MUTABLE (see binding_tracker::capture).
+            switch (TYPEOF(obj)) {
+            case NILSXP:
+            case SYMSXP:
+            case ENVSXP:
+            case PROMSXP:
+                break;
+            default:
+                SET_NAMED(obj, 2);
+                break;
+            }
+
+            uint64_t id = next_pin_id++;
+            pinned.emplace(id, pinned_object{ protected_sexp(obj), false, std::vector<size_t>() });
+            return id;
+        }
+
+        void unpin(uint64_t id) {
+            pinned.erase(id);
+        }
+
+        size_t unpin_all() {
+            size_t count = pinned.size();
+            pinned.clear();
+            return count;
+        }
+
+        SEXP get_pinned(uint64_t id) {
+            auto it = pinned.find(id);
+            return it != pinned.end() ? it->second.obj.get() : nullptr;
+        }
+    }
+}
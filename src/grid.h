@@ -0,0 +1,128 @@
+/* ****************************************************************************
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved. 
+ *
+ *
+ * This file is part of Microsoft R Host.
+ * 
+ * Microsoft R Host is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Microsoft R Host is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***************************************************************************/
+
+
+#pragma once
+#include "stdafx.h"
+#include "blobs.h"
+#include "r_api.h"
+
+namespace rhost {
+    namespace grid {
+        struct fetch_options {
+            // Strings longer than this many bytes are cut short (on a UTF-8 character boundary).
+            size_t max_string_length = std::numeric_limits<size_t>::max();
+
+            // If set, columns that have a class other than "factor" - such as Date or POSIXct - are sent as strings
+            // produced by format(), rather than as their underlying data for the client to format.
+            bool format_classed = false;
+        };
+
+        // Fetches a window of a pinned data frame, matrix, or atomic vector (which is treated as a single column), with
+        // rows from row_start up to row_count of them, and likewise for columns. If the object has a view (see
+        // set_view), rows are taken in the order of the view. The window is clipped to the size of the object (or
+        // of the view). Cell values go into data, one column after another, each starting at a multiple of 8 bytes;
+        // all numbers are in native byte order. Returns [nrow, ncol, row_names, columns], where nrow and ncol are
+        // the size of the whole object or view; row_names are the names of rows in the window, or null if rows are
+        // just numbered consecutively (so if there is a view, they are always there); and every column is:
+        //
+        //   [name, type, class, offset, size, levels, na]
+        //
+        // where offset and size are the location of the column data in the blob, and type is one of:
+        //
+        //   "double"  - 64-bit floating point numbers, with R NA and NaN bit patterns preserved.
+        //   "integer", "logical" - 32-bit integers, with NA being INT_MIN.
+        //   "factor"  - 32-bit 1-based indices into levels, or INT_MIN for NA. To keep the response size bounded by
+        //               the size of the window, levels only include those that occur in the window, in order of
+        //               their first occurrence there, rather than all levels of the factor.
+        //   "string"  - row_count + 1 32-bit offsets of the strings in the UTF-8 text that immediately follows
+        //               them; na lists indices of NA strings in the window, which are empty in the text.
+        //   "unsupported" - matrix or data frame columns of a data frame, for which no data is sent.
+        //
+        // Columns of other types (complex, lists etc), and classed ones if requested, are sent as strings produced by
+        // format(). levels and na are null where they don't apply.
+        //
+        // Must be called on the R thread, with the ID of an object that is pinned. Errors are reported via Rf_error.
+        picojson::value fetch(uint64_t pin, size_t row_start, size_t row_count, size_t col_start, size_t col_count,
+            const fetch_options& options, blobs::blob& data);
+
+        struct sort_spec {
+            size_t column;
+            bool descending;
+        };
+
+        // Selects rows where the cell in column satisfies op, which is one of "==", "!=", "<", "<=", ">", ">=",
+        // "contains", "is_na", "not_na". operand is a number for numeric and logical columns, and a string for
+        // character columns and factors (which are filtered by level labels); is_na and not_na ignore it.
+        struct filter_spec {
+            size_t column;
+            std::string op;
+            picojson::value operand;
+        };
+
+        // Sets the view of a pinned object to rows that satisfy all filters, ordered by sort keys (see gridview for
+        // details). Subsequent fetches index through the view, so that the object itself is not re-evaluated or
+        // re-sorted when paging through it. If there are no filters or sort keys, the view is reset to all rows
+        // in their original order. Returns the number of rows in the view in nrow, or false and a description of
+        // what's wrong in error, in which case the view is not changed.
+        //
+        // The kernels run on multiple threads, and read the object directly; the R thread is blocked while they
+        // run. Only numeric, logical, character, and factor columns can be sorted or filtered on. Character columns
+        // are sorted by the bytes of their strings, not in the order that order() would produce.
+        //
+        // Must be called on the R thread, with the ID of an object that is pinned.
+        bool set_view(uint64_t pin, const std::vector<sort_spec>& sort, const std::vector<filter_spec>& filters, size_t& nrow, std::string& error);
+
+        // Summarizes columns of a pinned object, or all of its columns if columns is null, for data viewer headers (see
+        // colstats::summary). The summary is always of the whole column, regardless of the view. result is an array
+        // with an item for every column:
+        //
+        //   [column, count, na_count, min, max, mean, distinct, histogram]
+        //
+        // where histogram has the specified number of bins. Values that are not applicable to the column are null; for
+        // columns that can't be summarized at all (anything other than numeric, logical, character, or factor, which
+        // is summarized by its codes), everything other than column is null.
+        //
+        // The columns are summarized on worker threads while the R thread is blocked. If canceled is set while that's
+        // going on, returns false as soon as possible, with error being "CANCELED". Returns false with some other error
+        // if the request itself is invalid.
+        //
+        // Must be called on the R thread, with the ID of an object that is pinned.
+        bool summarize_columns(uint64_t pin, const std::vector<size_t>* columns, size_t bins, const std::atomic<bool>& canceled,
+            picojson::value& result, std::string& error);
+
+        // Pinned objects are kept alive between requests, so that a viewer can keep fetching from the same object
+        // without re-evaluating the expression that produced it, even if the variable it came from is reassigned or
+        // modified (the object is marked as not mutable, so R copies it first).
+        // Only a limited number of objects can be pinned; once that's exceeded, the least recently pinned object is
+        // unpinned automatically. Must be called on the R thread.
+        uint64_t pin(SEXP obj);
+        void unpin(uint64_t id);
+
+        // Unpins all objects, and returns how many there were. Used to free memory when it's running low; the viewer
+        // finds out that they're gone on its next request for them, and can re-pin them. Must be called on the R thread.
+        size_t unpin_all();
+
+        // Returns nullptr if there's no pinned object with this ID.
+        SEXP get_pinned(uint64_t id);
+    }
+}
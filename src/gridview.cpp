@@ -0,0 +1,223 @@
+/* ****************************************************************************
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved. 
+ *
+ *
+ * This file is part of Microsoft R Host.
+ * 
+ * Microsoft R Host is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Microsoft R Host is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***************************************************************************/
+
+
+#include "stdafx.h"
+#include "gridview.h"
+
+namespace rhost {
+    namespace gridview {
+        namespace {
+            const int na_integer = std::numeric_limits<int>::min();
+
+            // Below this many rows per thread, starting threads costs more than it saves.
+            const size_t min_rows_per_thread = 32768;
+
+            size_t chunk_count_for(size_t nrow, unsigned thread_count) {
+                return std::max<size_t>(1, std::min<size_t>(thread_count, nrow / min_rows_per_thread));
+            }
+
+            // Runs body(i) for every i in [0, count), each on its own thread, except for the last one, which runs on
+            // the calling thread.
+            template <class F>
+            void parallel_for(size_t count, F body) {
+                if (count == 0) {
+                    return;
+                }
+
+                std::vector<std::thread> threads;
+                threads.reserve(count - 1);
+                for (size_t i = 0; i < count - 1; ++i) {
+                    threads.emplace_back([&body, i] { body(i); });
+                }
+                body(count - 1);
+
+                for (auto& thread : threads) {
+                    thread.join();
+                }
+            }
+
+            bool is_na(const column& col, size_t row) {
+                switch (col.kind) {
+                case column::real:
+                    return std::isnan(col.reals[row]);
+                case column::integer:
+                    return col.integers[row] == na_integer;
+                default:
+                    return col.strings[row] == nullptr;
+                }
+            }
+
+            bool test(const filter& f, const column& col, size_t row) {
+                switch (f.op) {
+                case filter::is_na:
+                    return is_na(col, row);
+                case filter::not_na:
+                    return !is_na(col, row);
+                case filter::in_set: {
+                    int value = col.integers[row];
+                    return value >= 0 && static_cast<size_t>(value) < f.set.size() && f.set[value];
+                }
+                default:
+                    break;
+                }
+
+                if (is_na(col, row)) {
+                    return false;
+                }
+
+                int cmp;
+                if (col.kind == column::string) {
+                    const char* s = col.strings[row];
+                    if (f.op == filter::contains) {
+                        return strstr(s, f.text.c_str()) != nullptr;
+                    }
+                    cmp = strcmp(s, f.text.c_str());
+                } else {
+                    double value = col.kind == column::real ? col.reals[row] : col.integers[row];
+                    cmp = (value > f.number) - (value < f.number);
+                }
+
+                switch (f.op) {
+                case filter::eq:
+                    return cmp == 0;
+                case filter::ne:
+                    return cmp != 0;
+                case filter::lt:
+                    return cmp < 0;
+                case filter::le:
+                    return cmp <= 0;
+                case filter::gt:
+                    return cmp > 0;
+                case filter::ge:
+                    return cmp >= 0;
+                default:
+                    return false;
+                }
+            }
+
+            int compare(const column& col, bool descending, size_t x, size_t y) {
+                bool x_na = is_na(col, x), y_na = is_na(col, y);
+                if (x_na || y_na) {
+                    return x_na - y_na;
+                }
+
+                int cmp;
+                switch (col.kind) {
+                case column::real:
+                    cmp = (col.reals[x] > col.reals[y]) - (col.reals[x] < col.reals[y]);
+                    break;
+                case column::integer:
+                    cmp = (col.integers[x] > col.integers[y]) - (col.integers[x] < col.integers[y]);
+                    break;
+                default:
+                    cmp = strcmp(col.strings[x], col.strings[y]);
+                    break;
+                }
+                return descending ? -cmp : cmp;
+            }
+
+            std::vector<size_t> filter_rows(const std::vector<column>& columns, size_t nrow, const std::vector<filter>& filters, unsigned thread_count) {
+                size_t chunk_count = chunk_count_for(nrow, thread_count);
+                std::vector<std::vector<size_t>> chunks(chunk_count);
+
+                parallel_for(chunk_count, [&](size_t i) {
+                    auto& rows = chunks[i];
+                    for (size_t row = nrow * i / chunk_count, end = nrow * (i + 1) / chunk_count; row < end; ++row) {
+                        if (std::all_of(filters.begin(), filters.end(), [&](const filter& f) { return test(f, columns[f.column], row); })) {
+                            rows.push_back(row);
+                        }
+                    }
+                });
+
+                if (chunk_count == 1) {
+                    return std::move(chunks[0]);
+                }
+
+                size_t total = 0;
+                for (const auto& chunk : chunks) {
+                    total += chunk.size();
+                }
+
+                std::vector<size_t> rows;
+                rows.reserve(total);
+                for (const auto& chunk : chunks) {
+                    rows.insert(rows.end(), chunk.begin(), chunk.end());
+                }
+                return rows;
+            }
+
+            // Sorts chunks of rows in parallel, and then merges them pairwise, also in parallel, until only one is left.
+            template <class Less>
+            void sort_rows(std::vector<size_t>& rows, Less less, unsigned thread_count) {
+                size_t chunk_count = chunk_count_for(rows.size(), thread_count);
+                std::vector<std::vector<size_t>::iterator> bounds;
+                for (size_t i = 0; i <= chunk_count; ++i) {
+                    bounds.push_back(rows.begin() + rows.size() * i / chunk_count);
+                }
+
+                parallel_for(chunk_count, [&](size_t i) {
+                    std::sort(bounds[i], bounds[i + 1], less);
+                });
+
+                for (size_t width = 1; width < chunk_count; width *= 2) {
+                    std::vector<size_t> merges;
+                    for (size_t i = 0; i + width < chunk_count; i += 2 * width) {
+                        merges.push_back(i);
+                    }
+
+                    parallel_for(merges.size(), [&](size_t m) {
+                        size_t i = merges[m];
+                        std::inplace_merge(bounds[i], bounds[i + width], bounds[std::min(i + 2 * width, chunk_count)], less);
+                    });
+                }
+            }
+        }
+
+        std::vector<size_t> build_view(const std::vector<column>& columns, size_t nrow, const std::vector<filter>& filters,
+            const std::vector<sort_key>& keys, unsigned thread_count) {
+            std::vector<size_t> rows;
+            if (filters.empty()) {
+                rows.resize(nrow);
+                std::iota(rows.begin(), rows.end(), size_t(0));
+            } else {
+                rows = filter_rows(columns, nrow, filters, thread_count);
+            }
+
+            if (!keys.empty()) {
+                // Row index is the final key, so that the order is total, and std::sort produces the same result as a
+                // stable sort would.
+                sort_rows(rows, [&](size_t x, size_t y) {
+                    for (const auto& key : keys) {
+                        int cmp = compare(columns[key.column], key.descending, x, y);
+                        if (cmp) {
+                            return cmp < 0;
+                        }
+                    }
+                    return x < y;
+                }, thread_count);
+            }
+
+            return rows;
+        }
+    }
+}
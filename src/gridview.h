@@ -0,0 +1,70 @@
+/* ****************************************************************************
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved. 
+ *
+ *
+ * This file is part of Microsoft R Host.
+ * 
+ * Microsoft R Host is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Microsoft R Host is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***************************************************************************/
+
+
+#pragma once
+#include "stdafx.h"
+
+namespace rhost {
+    namespace gridview {
+        // Kernels that sort and filter rows of a table for data viewers. They run on worker threads, and only read
+        // memory that was gathered beforehand on the R thread, which must stay blocked (so that nothing can be
+        // modified or collected) until they return. Nothing here calls into R.
+
+        // Cells of a single column. Logicals and factors are integer columns; NA is represented the same way R does
+        // it: NaN for reals, INT_MIN for integers, and nullptr for strings.
+        struct column {
+            enum { real, integer, string } kind;
+            const double* reals;
+            const int* integers;
+            std::vector<const char*> strings;
+        };
+
+        struct sort_key {
+            size_t column;
+            bool descending;
+        };
+
+        struct filter {
+            enum op_t { eq, ne, lt, le, gt, ge, contains, is_na, not_na, in_set } op;
+            size_t column;
+
+            // Operand of comparisons - number for real and integer columns, text for string columns.
+            double number;
+            std::string text;
+
+            // For in_set, whether every integer value (such as factor code) is in the set. Values outside of it, and NA,
+            // are not in the set.
+            std::vector<bool> set;
+        };
+
+        // Returns indices of rows that satisfy all filters, ordered by keys, with ties in ascending order of row
+        // index. NA values do not satisfy any filter other than is_na, and are sorted last regardless of direction,
+        // same as order() does. Strings are compared bytewise with strcmp, rather than collated according to the current
+        // locale as order() does, so the order of strings generally differs from that of order(); e.g. all uppercase
+        // ASCII letters sort before all lowercase ones.
+        //
+        // The work is split between up to thread_count threads, including the calling one.
+        std::vector<size_t> build_view(const std::vector<column>& columns, size_t nrow, const std::vector<filter>& filters,
+            const std::vector<sort_key>& keys, unsigned thread_count);
+    }
+}
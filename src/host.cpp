@@ -28,6 +28,14 @@
 #include "json.h"
 #include "blobs.h"
 #include "transport.h"
+#include "stats.h"
+#include "checkpoint.h"
+#include "completions.h"
+#include "grdeviceside.h"
+#include "grid.h"
+#include "jobs.h"
+#include "memory.h"
+#include "workspace.h"
 
 using namespace std::literals;
 using namespace boost::endian;
@@ -53,6 +61,15 @@ namespace rhost {
         fs::path rdata;
         std::atomic<bool> shutdown_requested(false);
 
+        // Set by prepare_forked_child in a process forked from the host.
+        bool is_forked_child = false;
+
+        void check_not_forked_child(const char* what) {
+            if (is_forked_child) {
+                Rf_error("%s is not available in a forked eval.", what);
+            }
+        }
+
         bool is_r_ready = false;
         std::mutex is_r_ready_lock;
         std::condition_variable is_r_ready_cond;
@@ -76,8 +93,12 @@ namespace rhost {
         std::mutex response_mutex;
 
         // Eval requests queued for execution. When eval begins executing, it is removed from this queue, and placed onto eval_stack.
-        std::queue<message> eval_requests;
-        std::mutex eval_requests_mutex;
+        // Pushed to by the transport thread, and popped by the R thread, which polls it frequently.
+        struct queued_eval {
+            message msg;
+            std::chrono::steady_clock::time_point queued_at;
+        };
+        mpsc_queue<queued_eval> eval_requests;
 
         struct eval_info {
             message_id id;
@@ -105,6 +126,14 @@ namespace rhost {
         message_id eval_cancel_target; // ID of the eval on the stack that is the cancellation target
         std::mutex eval_stack_mutex;
 
+        // Deadlines for evals that were requested with a timeout. When a deadline passes while its eval is still on the
+        // eval stack, deadline_thread cancels that eval exactly as if "!/" was received for it, and moves its ID from
+        // eval_deadlines to expired_evals, so that the response can report that the deadline was exceeded.
+        std::map<message_id, std::chrono::steady_clock::time_point> eval_deadlines;
+        std::set<message_id> expired_evals;
+        std::mutex eval_deadlines_mutex;
+        std::condition_variable eval_deadlines_cond;
+
         blob_id next_blob_id = 1;
         std::map<blob_id, blob> blobs;
         std::mutex blobs_mutex;
@@ -133,29 +162,140 @@ namespace rhost {
             idling_since = std::chrono::steady_clock::now();
         }
 
+        // Notifications queued by post_notification, in order. When a notification replaces a queued one with the
+        // same coalescing key, it takes its place in the queue.
+        struct posted_notification {
+            std::string name;
+            picojson::array args;
+        };
+
+        const size_t max_posted_notifications = 10000;
+        const auto posted_notifications_delay = 10ms;
+
+        std::vector<posted_notification> posted_notifications;
+        std::unordered_map<std::string, size_t> posted_notification_indices; // coalescing key -> index in posted_notifications
+        size_t dropped_notifications; // since the last flush, because the queue was full
+        std::mutex posted_notifications_mutex;
+        std::condition_variable posted_notifications_cond;
+
+        // Held while sending queued notifications, so that synchronously sent ones cannot overtake them.
+        std::mutex posted_notifications_send_mutex;
+
+        // Must be called with posted_notifications_send_mutex held.
+        void flush_posted_notifications() {
+            std::vector<posted_notification> batch;
+            size_t dropped;
+            {
+                std::lock_guard<std::mutex> lock(posted_notifications_mutex);
+                batch.swap(posted_notifications);
+                posted_notification_indices.clear();
+                dropped = dropped_notifications;
+                dropped_notifications = 0;
+            }
+
+            if (batch.empty()) {
+                return;
+            }
+
+            std::vector<message> msgs;
+            msgs.reserve(batch.size() + 1);
+            for (const auto& notification : batch) {
+                msgs.emplace_back(0, notification.name, notification.args, blob());
+            }
+
+            // Notifications were dropped after everything in the batch had been queued, so report that last.
+            if (dropped) {
+                msgs.emplace_back(0, "!NotificationsDropped", picojson::array{ picojson::value(static_cast<double>(dropped)) }, blob());
+            }
+
+            transport::send_messages(msgs);
+        }
+
+        void posted_notifications_thread() {
+            for (;;) {
+                {
+                    std::unique_lock<std::mutex> lock(posted_notifications_mutex);
+                    posted_notifications_cond.wait(lock, [] { return !posted_notifications.empty(); });
+                }
+
+                // Code that posts notifications usually posts a lot of them in quick succession, so give it
+                // a chance to queue up (and coalesce) more before sending them all at once.
+                std::this_thread::sleep_for(posted_notifications_delay);
+
+                std::lock_guard<std::mutex> send_lock(posted_notifications_send_mutex);
+                flush_posted_notifications();
+            }
+        }
+
+        void post_notification(const std::string& name, picojson::array&& args, const std::string& coalescing_key) {
+            assert(name[0] == '!');
+
+            if (is_forked_child) {
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock(posted_notifications_mutex);
+
+            if (!coalescing_key.empty()) {
+                auto it = posted_notification_indices.find(coalescing_key);
+                if (it != posted_notification_indices.end()) {
+                    auto& notification = posted_notifications[it->second];
+                    notification.name = name;
+                    notification.args = std::move(args);
+                    return;
+                }
+            }
+
+            // If the client can't keep up, drop the notification rather than queue up notifications indefinitely, or
+            // make the producer wait - which could be the R thread. The client is told how many were dropped.
+            if (posted_notifications.size() >= max_posted_notifications) {
+                ++dropped_notifications;
+                return;
+            }
+
+            if (!coalescing_key.empty()) {
+                posted_notification_indices[coalescing_key] = posted_notifications.size();
+            }
+
+            posted_notifications.push_back(posted_notification{ name, std::move(args) });
+            posted_notifications_cond.notify_all();
+        }
+
         message_id send_notification(const std::string& name, const picojson::array& args, const blob& blob) {
             assert(name[0] == '!');
 
+            if (is_forked_child) {
+                return 0;
+            }
+
             reset_idle_timer();
 
             message msg(0, name, args, blob);
+
+            std::lock_guard<std::mutex> send_lock(posted_notifications_send_mutex);
+            flush_posted_notifications();
             transport::send_message(msg);
             return msg.id();
         }
 
         template<class... Args>
-        message_id respond_to_message(const message& request, const blob& blob, Args... args) {
+        message make_response(const message& request, const blob& blob, Args... args) {
             assert(request.name()[0] == '?');
 
-            reset_idle_timer();
-
             picojson::array json;
             rhost::util::append(json, args...);
 
             std::string name = request.name();
             name[0] = ':';
 
-            message msg(request.id(), name, json, blob);
+            return message(request.id(), name, json, blob);
+        }
+
+        template<class... Args>
+        message_id respond_to_message(const message& request, const blob& blob, Args... args) {
+            reset_idle_timer();
+
+            auto msg = make_response(request, blob, args...);
             transport::send_message(msg);
             return msg.id();
         }
@@ -166,8 +306,8 @@ namespace rhost {
             return respond_to_message(request, empty, args...);
         }
 
-        bool query_interrupt() {
-            std::lock_guard<std::mutex> lock(eval_stack_mutex);
+        // Must be called with eval_stack_mutex held.
+        bool query_interrupt_locked() {
             if (!canceling_eval) {
                 return false;
             }
@@ -177,6 +317,20 @@ namespace rhost {
             return it == eval_stack.end();
         }
 
+        bool query_interrupt() {
+            std::lock_guard<std::mutex> lock(eval_stack_mutex);
+            return query_interrupt_locked();
+        }
+
+        // If there's no longer anything to interrupt, make sure that R doesn't act on an earlier request_interrupt
+        // (e.g. because the eval that was being canceled has completed before R got around to checking for it).
+        void retract_stale_interrupt() {
+            std::lock_guard<std::mutex> lock(eval_stack_mutex);
+            if (!query_interrupt_locked()) {
+                retract_interrupt();
+            }
+        }
+
         // Unblock any pending with_response call that is waiting in a message loop.
         void unblock_message_loop() {
             // Because PeekMessage can dispatch messages that were sent, which may in turn result 
@@ -230,6 +384,9 @@ namespace rhost {
                 return;
             }
 
+            // Also stops new checkpoints from being started.
+            checkpoint::abort();
+
             if (!rdata.empty()) {
                 std::string s = rdata.string();
                 logf(log_verbosity::minimal, "Saving workspace to %s...\n", s.c_str());
@@ -411,6 +568,136 @@ namespace rhost {
             }
         }
 
+        picojson::value get_stats() {
+            double blob_count, blob_bytes = 0;
+            {
+                std::lock_guard<std::mutex> lock(blobs_mutex);
+                blob_count = static_cast<double>(blobs.size());
+                for (const auto& kv : blobs) {
+                    blob_bytes += kv.second.size();
+                }
+            }
+
+            picojson::object eval_queue;
+            eval_queue["length"] = picojson::value(static_cast<double>(stats::eval_queue_length.load(std::memory_order_relaxed)));
+            eval_queue["depth"] = stats::eval_queue_depth.to_json();
+            eval_queue["wait_us"] = stats::eval_queue_wait_time.to_json();
+
+            picojson::object blobs_stats;
+            blobs_stats["count"] = picojson::value(blob_count);
+            blobs_stats["bytes"] = picojson::value(blob_bytes);
+
+            picojson::object plots;
+            plots["render_us"] = stats::plot_render_time.to_json();
+
+            picojson::object transport;
+            transport["stall_us"] = stats::transport_stall_time.to_json();
+
+            picojson::object workspace_stats;
+            workspace_stats["tracking_us"] = stats::workspace_tracking_time.to_json();
+
+            picojson::object memory_stats;
+            memory_stats["status"] = memory::to_json(memory::get_status());
+            memory_stats["relief_us"] = stats::memory_relief_time.to_json();
+
+            picojson::object result;
+            result["uptime_s"] = picojson::value(std::chrono::duration<double>(stats::uptime()).count());
+            result["startup_ms"] = stats::startup_phases();
+            result["messages"] = stats::message_stats();
+            result["eval_queue"] = picojson::value(std::move(eval_queue));
+            result["evals"] = stats::eval_histograms();
+            result["blobs"] = picojson::value(std::move(blobs_stats));
+            result["plots"] = picojson::value(std::move(plots));
+            result["transport"] = picojson::value(std::move(transport));
+            result["workspace"] = picojson::value(std::move(workspace_stats));
+            result["memory"] = picojson::value(std::move(memory_stats));
+            return picojson::value(std::move(result));
+        }
+
+        // Handles "?Completions [prefix, ns, max]" - looks up symbols starting with prefix in the search path if ns is null,
+        // or else in exports of the namespace named ns, returning up to max of them (all if null). The response is
+        // [items, is_complete], as described for completions::query. This is answered from the symbol index directly,
+        // without waiting for the R thread, so it's fast enough to issue on every keystroke even while R is busy.
+        void handle_completions(const message& msg) {
+            assert(!strcmp(msg.name(), "?Completions"));
+
+            auto args = msg.json();
+            if (args.size() != 3 || !args[0].is<std::string>() || !(args[1].is<picojson::null>() || args[1].is<std::string>()) ||
+                !(args[2].is<picojson::null>() || args[2].is<double>())) {
+                fatal_error("Completions: must have form [prefix, ns, max]");
+            }
+
+            const std::string* ns = args[1].is<std::string>() ? &args[1].get<std::string>() : nullptr;
+            auto max_count = args[2].is<double>() ? static_cast<size_t>(args[2].get<double>()) : std::numeric_limits<size_t>::max();
+            auto result = completions::query(args[0].get<std::string>(), ns, max_count);
+
+            const auto& items_and_completeness = result.get<picojson::array>();
+            respond_to_message(msg, items_and_completeness[0], items_and_completeness[1]);
+        }
+
+        void handle_stats(const message& msg) {
+            assert(!strcmp(msg.name(), "?Stats"));
+            respond_to_message(msg, get_stats());
+        }
+
+        // Handles "?MemoryStatus []" - responds with the current memory figures, as produced by memory::to_json. Like
+        // "?Stats", this is answered without waiting for the R thread.
+        void handle_memory_status(const message& msg) {
+            assert(!strcmp(msg.name(), "?MemoryStatus"));
+            respond_to_message(msg, memory::to_json(memory::get_status()));
+        }
+
+        // Job control messages. See jobs.h for details on how jobs are run, and what's reported about them.
+
+        // "?JobSubmit [name, script]" - response is [id]. On Windows, the job fails without running.
+        void handle_job_submit(const message& msg) {
+            assert(!strcmp(msg.name(), "?JobSubmit"));
+
+            auto args = msg.json();
+            if (args.size() != 2 || !args[0].is<std::string>() || !args[1].is<std::string>()) {
+                fatal_error("JobSubmit: must have form [name, script]");
+            }
+
+            auto id = jobs::submit(args[0].get<std::string>(), args[1].get<std::string>());
+            respond_to_message(msg, static_cast<double>(id));
+        }
+
+        // "?JobList []" - response is [jobs].
+        void handle_job_list(const message& msg) {
+            assert(!strcmp(msg.name(), "?JobList"));
+            respond_to_message(msg, picojson::value(jobs::list()));
+        }
+
+        // "!JobCancel [id]".
+        void handle_job_cancel(const message& msg) {
+            assert(!strcmp(msg.name(), "!JobCancel"));
+
+            auto args = msg.json();
+            if (args.size() != 1 || !args[0].is<double>()) {
+                fatal_error("JobCancel: non-numeric job ID");
+            }
+
+            jobs::cancel(static_cast<jobs::job_id>(args[0].get<double>()));
+        }
+
+        // "?JobOutput [id, offset]" - response is [text, end_offset], or [null, null] if there's no such job.
+        void handle_job_output(const message& msg) {
+            assert(!strcmp(msg.name(), "?JobOutput"));
+
+            auto args = msg.json();
+            if (args.size() != 2 || !args[0].is<double>() || !args[1].is<double>()) {
+                fatal_error("JobOutput: must have form [id, offset]");
+            }
+
+            std::string text;
+            uint64_t end_offset;
+            if (jobs::get_output(static_cast<jobs::job_id>(args[0].get<double>()), static_cast<uint64_t>(args[1].get<double>()), text, end_offset)) {
+                respond_to_message(msg, text, static_cast<double>(end_offset));
+            } else {
+                respond_to_message(msg, picojson::value(), picojson::value());
+            }
+        }
+
         void get_blob_size(const message& msg) {
             assert(!strcmp(msg.name(), "?GetBlobSize"));
 
@@ -532,75 +819,483 @@ namespace rhost {
                 fatal_error("WriteBlob: no blob with ID %llu", id);
             }
 
+            // Write directly from the message payload, rather than going through msg.blob(), which makes a copy.
+            const char* data = msg.blob_data();
+            size_t data_size = msg.blob_size();
             if (pos == -1 || pos == it->second.size()) {
                 // append to the end of the blob
-                auto blob = msg.blob();
-                it->second.insert(it->second.end(), blob.begin(), blob.end());
+                it->second.insert(it->second.end(), data, data + data_size);
             } else {
                 // write/over-write at position
-                auto blob = msg.blob();
                 size_t size = static_cast<size_t>(pos);
-                size += blob.size();
+                size += data_size;
                 if (it->second.size() < size) {
                     it->second.resize(size);
                 }
 
-                std::copy(blob.begin(), blob.end(), it->second.begin() + static_cast<size_t>(pos));
+                std::copy(data, data + data_size, it->second.begin() + static_cast<size_t>(pos));
             }
             
             respond_to_message(msg, ensure_fits_double(it->second.size()));
         }
 
-        void handle_eval(const message& msg) {
-            assert(msg.name()[0] == '?' && msg.name()[1] == '=');
+#ifndef _WIN32
+        // Evals with the 'f' flag that are running in forked child processes, keyed on request ID. An entry is removed
+        // once its child has exited, but before it is reaped, so that its PID cannot be reused by some other process
+        // while it's still here, and it's always safe to kill it.
+        struct forked_eval_info {
+            pid_t pid;
+            bool is_canceled;
+        };
+        std::map<message_id, forked_eval_info> forked_evals;
+        std::mutex forked_evals_mutex;
+        const size_t max_forked_evals = std::max(1u, std::thread::hardware_concurrency());
+#endif
 
-            auto args = msg.json();
-            if (args.size() != 1 || !args[0].is<std::string>()) {
-                fatal_error("Invalid evaluation request #%llu#: must have form [expr].", msg.id());
+        // If the eval with the specified ID is running in a forked child process, kills that process, and returns true.
+        bool cancel_forked_eval(message_id eval_id) {
+#ifdef _WIN32
+            return false;
+#else
+            std::lock_guard<std::mutex> lock(forked_evals_mutex);
+            auto it = forked_evals.find(eval_id);
+            if (it == forked_evals.end()) {
+                return false;
             }
 
-            SCOPE_WARDEN_RESTORE(allow_callbacks);
-            allow_callbacks = false;
+            if (!it->second.is_canceled) {
+                it->second.is_canceled = true;
+                kill(it->second.pid, SIGKILL);
+            }
+            return true;
+#endif
+        }
 
-            const auto& expr = from_utf8(args[0].get<std::string>());
-            log::logf(log_verbosity::traffic, "#%llu# = %s\n\n", msg.id(), expr.c_str());
+        // Requests that are being handled by native code on worker threads while the R thread waits for it to complete,
+        // keyed on request ID. Such code periodically checks the flag, and stops early once it's set by "!/".
+        std::map<message_id, std::shared_ptr<std::atomic<bool>>> native_requests;
+        std::mutex native_requests_mutex;
+
+        // Sets the cancellation flag of the native request with the specified ID, or of all native requests if ID is 0.
+        // Returns true if there was such a request.
+        bool cancel_native_request(message_id id) {
+            std::lock_guard<std::mutex> lock(native_requests_mutex);
+            if (id == 0) {
+                for (auto& request : native_requests) {
+                    *request.second = true;
+                }
+                return !native_requests.empty();
+            }
 
-            SEXP env = nullptr;
-            bool is_cancelable = false, new_env = false, no_result = false, raw_response = false;
+            auto it = native_requests.find(id);
+            if (it == native_requests.end()) {
+                return false;
+            }
+            *it->second = true;
+            return true;
+        }
+
+        // Marks the eval with the specified ID, and everything nested in it, for cancellation. Returns true if that
+        // eval is on the stack and is now being canceled, either as the target of this request, or because some eval
+        // below it was already being canceled. The caller is responsible for calling unblock_message_loop.
+        //
+        // Forked evals are not on the stack, and are canceled individually by killing their process.
+        bool cancel_eval(message_id eval_id) {
+            if (eval_id == 0) {
+                // Native requests block the R thread, so they're canceled along with the top-level eval.
+                cancel_native_request(0);
+            } else if (cancel_native_request(eval_id) || cancel_forked_eval(eval_id)) {
+                return true;
+            }
+
+            std::lock_guard<std::mutex> lock(eval_stack_mutex);
+
+            for (auto it = eval_stack.begin(); it != eval_stack.end(); ++it) {
+                if (canceling_eval && it->id == eval_cancel_target) {
+                    // If we're already in the process of cancelling some eval, and that one is below the
+                    // one that we're been asked to cancel in the stack, then we don't need to do anything.
+                    return std::any_of(it, eval_stack.end(), [&](const eval_info& ei) { return ei.id == eval_id; });
+                }
+
+                if (it->id == eval_id) {
+                    canceling_eval = true;
+                    eval_cancel_target = eval_id;
+
+                    // Don't wait for R to call back into the host, which it might not do for a long time if it's
+                    // busy in native code, but have it interrupt itself at the next opportunity (unless delivery
+                    // is via callbacks only). R doesn't always call back before it acts on that, and then it
+                    // interrupts whatever is innermost; so only do this if that is the eval being canceled. If
+                    // another eval is pushed on top of it before R gets to it, the request is retracted then.
+                    if (eval_stack.back().id == eval_id && query_interrupt_locked()) {
+                        request_interrupt();
+                    }
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        void set_eval_deadline(message_id id, std::chrono::steady_clock::time_point deadline) {
+            std::lock_guard<std::mutex> lock(eval_deadlines_mutex);
+            eval_deadlines[id] = deadline;
+            eval_deadlines_cond.notify_one();
+        }
+
+        // Removes the deadline for the eval with the specified ID, and returns true if it had already expired.
+        bool clear_eval_deadline(message_id id) {
+            std::lock_guard<std::mutex> lock(eval_deadlines_mutex);
+            eval_deadlines.erase(id);
+            return expired_evals.erase(id) != 0;
+        }
+
+        void deadline_thread() {
+            std::unique_lock<std::mutex> lock(eval_deadlines_mutex);
+            for (;;) {
+                if (eval_deadlines.empty()) {
+                    eval_deadlines_cond.wait(lock);
+                    continue;
+                }
+
+                auto earliest = std::min_element(eval_deadlines.begin(), eval_deadlines.end(),
+                    [](const auto& x, const auto& y) { return x.second < y.second; });
+                if (earliest->second > std::chrono::steady_clock::now()) {
+                    eval_deadlines_cond.wait_until(lock, earliest->second);
+                    continue;
+                }
+
+                auto id = earliest->first;
+                eval_deadlines.erase(earliest);
+
+                // eval_deadlines_mutex is held across the cancellation, so that clear_eval_deadline cannot observe
+                // the eval as not expired after it has been canceled.
+                if (cancel_eval(id)) {
+                    logf(log_verbosity::normal, "#%llu# deadline exceeded, canceling.\n", id);
+                    expired_evals.insert(id);
+
+                    lock.unlock();
+                    unblock_message_loop();
+                    lock.lock();
+                }
+            }
+        }
+
+        // Options for a single evaluation, as specified by the flags that follow "?=" in the request name.
+        struct eval_flags {
+            SEXP env;
+            bool is_cancelable, new_env, no_result, raw_response, allow_callbacks, streaming, metrics, pure, forked;
+            parse_cache_mode cache_mode;
+
+            // Flags exactly as they appeared in the request, for use as part of the memoization key.
+            std::string spec;
+
+            eval_flags()
+                : env(nullptr), is_cancelable(false), new_env(false), no_result(false), raw_response(false),
+                  allow_callbacks(false), streaming(false), metrics(false), pure(false), forked(false),
+                  cache_mode(parse_cache_mode::normal) {
+            }
+        };
+
+        // Outcome of a single evaluation, in the form in which it is reported to the client.
+        struct eval_outcome {
+            picojson::value parse_status, error, value;
+            // For raw evals, the RAWSXP or NILSXP value itself. Its bytes are written straight from R heap into
+            // the response, so that large values aren't copied.
+            protected_sexp raw_value;
+            bool is_canceled, deadline_exceeded;
+            // For streaming evals, the number of "!EvalChunk" notifications that were sent for the value.
+            size_t chunk_count;
+
+            // Where the time went. GC figures are only collected if metrics were requested.
+            std::chrono::steady_clock::duration parse_time, eval_time, serialize_time;
+            std::chrono::duration<double> gc_time;
+            uint64_t gc_count;
+
+            eval_outcome()
+                : is_canceled(false), deadline_exceeded(false), chunk_count(0),
+                  parse_time(), eval_time(), serialize_time(), gc_time(), gc_count(0) {
+            }
+        };
+
+        // Reports the breakdown of time and resources for an eval with the 'm' flag. Because the response itself
+        // must be sent before the time it took to send it is known, this is sent as a separate notification with
+        // arguments [request_id, metrics] immediately after the response.
+        void send_eval_metrics(message_id request_id, const eval_outcome& outcome,
+                               std::chrono::steady_clock::duration send_time, size_t result_size) {
+            auto ms = [](std::chrono::duration<double> d) {
+                return picojson::value(std::chrono::duration<double, std::milli>(d).count());
+            };
+
+            picojson::object metrics;
+            metrics["parse_ms"] = ms(outcome.parse_time);
+            metrics["eval_ms"] = ms(outcome.eval_time);
+            metrics["serialize_ms"] = ms(outcome.serialize_time);
+            metrics["send_ms"] = ms(send_time);
+            metrics["gc_ms"] = ms(outcome.gc_time);
+            metrics["gc_count"] = picojson::value(static_cast<double>(outcome.gc_count));
+            metrics["result_bytes"] = picojson::value(static_cast<double>(result_size));
+
+            send_notification("!EvalMetrics", static_cast<double>(request_id), picojson::value(std::move(metrics)));
+        }
+
+        // Size of the pieces into which raw values are split when streaming.
+        const size_t eval_chunk_size = 0x100000;
+
+        void send_eval_chunk(message_id request_id, const picojson::value& key, const picojson::value& value,
+                             const char* data = nullptr, size_t size = 0) {
+            reset_idle_timer();
+
+            picojson::array args;
+            append(args, static_cast<double>(request_id), key, value);
+
+            message msg(0, "!EvalChunk", args, data, size);
+            transport::send_message(msg);
+        }
+
+        // Sends the value of a streaming eval to the client as a sequence of "!EvalChunk" notifications, each of
+        // which has arguments [request_id, key, value], where key is either the numeric index of the chunk, or the
+        // name of the list element or environment binding that it contains. This way, at most one element of the
+        // value is serialized at any given time, and the client can start consuming the value before it's complete.
+        //
+        // For raw values, each chunk carries up to eval_chunk_size bytes as a blob, key is the offset of those bytes
+        // in the value, and value is null. Unnamed lists are sent with one element per chunk, and named lists and
+        // environments with one binding per chunk. Elements that serialize to NA are skipped, as they would be in
+        // a non-streaming response. Any other value is not split, and is returned in value to be sent in the final
+        // response instead.
+        size_t stream_eval_result(message_id id, SEXP sexp, bool raw, picojson::value& value) {
+            size_t chunk_count = 0;
+            int type = TYPEOF(sexp);
+
+            if (raw) {
+                if (type != RAWSXP) {
+                    // Produces the appropriate error for unsupported types, and does nothing for NULL.
+                    blob empty;
+                    to_blob(sexp, empty);
+                    return 0;
+                }
+
+                const char* data = reinterpret_cast<const char*>(RAW(sexp));
+                size_t size = Rf_length(sexp);
+                for (size_t offset = 0; offset < size; offset += eval_chunk_size) {
+                    send_eval_chunk(id, picojson::value(static_cast<double>(offset)), picojson::value(),
+                                    data + offset, std::min(eval_chunk_size, size - offset));
+                    ++chunk_count;
+                }
+                return chunk_count;
+            }
+
+            auto send_elem = [&](const picojson::value& key, SEXP elem_sexp) {
+                picojson::value elem;
+                bool is_na = false;
+                errors_to_exceptions([&] { is_na = !to_json(elem_sexp, elem); });
+                if (!is_na) {
+                    send_eval_chunk(id, key, elem);
+                    ++chunk_count;
+                }
+            };
+
+            if (type == VECSXP) {
+                SEXP names = Rf_getAttrib(sexp, R_NamesSymbol);
+                R_len_t count = Rf_length(sexp);
+                for (R_len_t i = 0; i < count; ++i) {
+                    picojson::value key;
+                    if (Rf_isNull(names)) {
+                        key = picojson::value(static_cast<double>(i));
+                    } else {
+                        SEXP name_sexp = STRING_ELT(names, i);
+                        if (name_sexp == R_NaString) {
+                            throw r_error("All elements in list must be named.");
+                        }
+                        key = picojson::value(std::string(Rf_translateCharUTF8(name_sexp)));
+                    }
+                    send_elem(key, VECTOR_ELT(sexp, i));
+                }
+            } else if (type == ENVSXP) {
+                protected_sexp names(R_lsInternal3(sexp, R_TRUE, R_FALSE));
+                R_len_t count = Rf_length(names.get());
+                for (R_len_t i = 0; i < count; ++i) {
+                    SEXP name_sexp = STRING_ELT(names.get(), i);
+                    send_elem(picojson::value(std::string(Rf_translateCharUTF8(name_sexp))), Rf_findVar(Rf_installChar(name_sexp), sexp));
+                }
+            } else {
+                errors_to_exceptions([&] { to_json(sexp, value); });
+            }
+
+            return chunk_count;
+        }
+
+        // Parses the optional timeout argument of an eval request, which is the number of seconds (or null for no timeout).
+        std::chrono::steady_clock::duration parse_eval_timeout(const message& msg, const picojson::value& arg) {
+            if (arg.is<picojson::null>()) {
+                return std::chrono::steady_clock::duration::zero();
+            }
+            if (!arg.is<double>() || arg.get<double>() <= 0) {
+                fatal_error("Invalid evaluation request #%llu#: timeout must be a positive number of seconds, or null.", msg.id());
+            }
+            return std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(arg.get<double>()));
+        }
+
+        eval_flags parse_eval_flags(const char* name, const char* flags) {
+            eval_flags ef;
+            ef.spec = flags;
 
-            for (const char* p = msg.name() + 2; *p; ++p) {
+            for (const char* p = flags; *p; ++p) {
                 switch (char c = *p) {
                 case 'B':
                 case 'E':
-                    if (env != nullptr) {
-                        fatal_error("'%s': multiple environment flags specified.", msg.name());
+                    if (ef.env != nullptr) {
+                        fatal_error("'%s': multiple environment flags specified.", name);
                     }
-                    env = (c == 'B') ? R_BaseEnv : R_EmptyEnv;
+                    ef.env = (c == 'B') ? R_BaseEnv : R_EmptyEnv;
                     break;
                 case 'N':
-                    new_env = true;
+                    ef.new_env = true;
                     break;
                 case '@':
-                    allow_callbacks = true;
+                    ef.allow_callbacks = true;
                     break;
                 case '/':
-                    is_cancelable = true;
+                    ef.is_cancelable = true;
                     break;
                 case '0':
-                    no_result = true;
+                    ef.no_result = true;
                     break;
                 case 'r':
-                    raw_response = true;
+                    ef.raw_response = true;
+                    break;
+                case 'p':
+                    ef.cache_mode = parse_cache_mode::bypass;
+                    break;
+                case 'h':
+                    if (ef.cache_mode != parse_cache_mode::bypass) {
+                        ef.cache_mode = parse_cache_mode::hot;
+                    }
+                    break;
+                case 's':
+                    ef.streaming = true;
+                    break;
+                case 'm':
+                    ef.metrics = true;
+                    break;
+                case 'i':
+                    ef.pure = true;
+                    break;
+                case 'f':
+                    ef.forked = true;
                     break;
                 default:
-                    fatal_error("'%s': unrecognized flag '%c'.", msg.name(), c);
+                    fatal_error("'%s': unrecognized flag '%c'.", name, c);
                 }
             }
 
-            if (!env) {
-                env = R_GlobalEnv;
+            if (!ef.env) {
+                ef.env = R_GlobalEnv;
+            }
+
+            if (ef.pure && ef.streaming) {
+                fatal_error("'%s': flags 'i' and 's' cannot be combined.", name);
+            }
+
+            if (ef.forked && (ef.streaming || ef.allow_callbacks || ef.pure || ef.metrics)) {
+                fatal_error("'%s': flag 'f' cannot be combined with 's', '@', 'i' or 'm'.", name);
+            }
+
+            return ef;
+        }
+
+        // Outcomes of recent pure ('i') evals, keyed on flags and expression. An entry is only valid for as long as
+        // nothing could have modified any environment since it was produced, so the whole cache is dropped whenever
+        // R leaves the ReadConsole prompt to evaluate input, and whenever any other R code is run on behalf of the
+        // client - evals without 'i', and expressions that are arguments of other requests (see eval_expression). Pure
+        // evals are only memoized while R is idle at the prompt with no other evals in progress, since otherwise
+        // whatever code is running could change the environment between two identical requests.
+        //
+        // Environments can still be modified by code that R runs on its own while idle (e.g. event loop handlers),
+        // so 'i' is a promise made by the client that such changes are not relevant to the query.
+        //
+        // Once the cache is full, the least recently used entry is evicted. Most recently used entries are at the front
+        // of the list; map values point into the list.
+        const size_t pure_eval_cache_capacity = 64;
+        const size_t pure_eval_cache_max_blob_size = 0x100000;
+        typedef std::list<std::pair<std::string, eval_outcome>> pure_eval_cache_list;
+        pure_eval_cache_list pure_eval_cache;
+        std::unordered_map<std::string, pure_eval_cache_list::iterator> pure_eval_cache_index;
+        uint64_t pure_eval_cache_generation; // incremented every time the cache is invalidated
+        bool is_at_prompt;
+
+        void invalidate_pure_eval_cache() {
+            pure_eval_cache_index.clear();
+            pure_eval_cache.clear();
+            ++pure_eval_cache_generation;
+        }
+
+        bool is_idle_at_prompt() {
+            if (!is_at_prompt) {
+                return false;
+            }
+
+            std::lock_guard<std::mutex> lock(eval_stack_mutex);
+            return eval_stack.size() == 1;
+        }
+
+        std::string pure_eval_key(const std::string& expr, const eval_flags& ef) {
+            std::string key = ef.spec;
+            key += '\0';
+            key += expr;
+            return key;
+        }
+
+        picojson::value parse_status_to_json(ParseStatus ps) {
+            switch (ps) {
+            case PARSE_NULL:
+                return picojson::value("NULL");
+            case PARSE_OK:
+                return picojson::value("OK");
+            case PARSE_INCOMPLETE:
+                return picojson::value("INCOMPLETE");
+            case PARSE_ERROR:
+                return picojson::value("ERROR");
+            case PARSE_EOF:
+                return picojson::value("EOF");
+            default:
+                return picojson::value(double(ps));
+            }
+        }
+
+        // Evaluates expr, registering it on the eval stack under the given ID, so that it can be targeted
+        // by cancellation requests. If timeout is non-zero, the eval is canceled once it runs for longer
+        // than that, regardless of whether it was requested as cancelable.
+        eval_outcome evaluate(message_id id, const std::string& expr, const eval_flags& ef,
+                              std::chrono::steady_clock::duration timeout = std::chrono::steady_clock::duration::zero()) {
+            bool memoize = ef.pure && is_idle_at_prompt();
+            if (memoize) {
+                auto it = pure_eval_cache_index.find(pure_eval_key(expr, ef));
+                if (it != pure_eval_cache_index.end()) {
+                    auto entry = it->second;
+                    pure_eval_cache.splice(pure_eval_cache.begin(), pure_eval_cache, entry);
+                    return entry->second;
+                }
+            } else if (!ef.pure) {
+                invalidate_pure_eval_cache();
+            }
+            auto generation = pure_eval_cache_generation;
+
+            SCOPE_WARDEN_RESTORE(allow_callbacks);
+            allow_callbacks = ef.allow_callbacks;
+
+            eval_outcome outcome;
+
+            uint64_t gc_count_before = 0;
+            std::chrono::duration<double> gc_time_before;
+            if (ef.metrics) {
+                gc_count_before = stats::r_gc_count();
+                gc_time_before = stats::r_gc_time();
             }
 
+            bool has_deadline = timeout > std::chrono::steady_clock::duration::zero();
+            bool is_cancelable = ef.is_cancelable || has_deadline;
+            auto deadline = std::chrono::steady_clock::now() + timeout;
+
             r_eval_result<protected_sexp> result = {};
             ParseStatus ps;
             {
@@ -612,9 +1307,22 @@ namespace rhost {
 
                 bool was_before_invoked = false;
                 auto before = [&] {
-                    std::lock_guard<std::mutex> lock(eval_stack_mutex);
-                    eval_stack.push_back(eval_info(msg.id(), is_cancelable));
-                    was_before_invoked = true;
+                    {
+                        std::lock_guard<std::mutex> lock(eval_stack_mutex);
+                        eval_stack.push_back(eval_info(id, is_cancelable));
+                        was_before_invoked = true;
+
+                        // Any pending interrupt request was for an eval that's no longer innermost, and R must not
+                        // act on it inside this one. If it's still being canceled, do_r_callback takes care of that.
+                        retract_interrupt();
+                    }
+
+                    // The deadline can only cancel the eval while it's on the stack, so (re-)arm it every time a
+                    // new top-level expression begins evaluating. If it has already passed, the eval is canceled
+                    // as soon as it starts.
+                    if (has_deadline) {
+                        set_eval_deadline(id, deadline);
+                    }
                 };
 
                 bool was_after_invoked = false;
@@ -623,14 +1331,14 @@ namespace rhost {
 
                     if (was_before_invoked) {
                         assert(!eval_stack.empty());
-                        assert(eval_stack.end()[-1].id == msg.id());
+                        assert(eval_stack.end()[-1].id == id);
                     }
 
-                    if (canceling_eval && msg.id() == eval_cancel_target) {
+                    if (canceling_eval && id == eval_cancel_target) {
                         // If we were unwinding the stack for cancellation purposes, and this eval was the target
                         // of the cancellation, then we're done and should stop unwinding. Otherwise, we should 
-                        // continue unwinding after reporting the result of the evaluation, which we'll do at the
-                        // end of handle_eval if this flag is still set.
+                        // continue unwinding after reporting the result of the evaluation, which handle_eval (or
+                        // handle_eval_batch) will do at the end if this flag is still set.
                         canceling_eval = false;
                     }
 
@@ -641,12 +1349,20 @@ namespace rhost {
                     was_after_invoked = true;
                 };
 
-                protected_sexp eval_env(new_env ? Rf_NewEnvironment(R_NilValue, R_NilValue, env) : env);
+                protected_sexp eval_env(ef.new_env ? Rf_NewEnvironment(R_NilValue, R_NilValue, ef.env) : ef.env);
+
+                auto parse_start = std::chrono::steady_clock::now();
+                auto parsed = r_parse(expr, ps, ef.cache_mode);
+                auto eval_start = std::chrono::steady_clock::now();
+                outcome.parse_time = eval_start - parse_start;
 
-                auto results = r_try_eval(expr, eval_env.get(), ps, before, after);
-                if (!results.empty()) {
-                    result = results.back();
+                if (ps == PARSE_OK) {
+                    auto results = r_try_eval(parsed.get(), eval_env.get(), before, after);
+                    if (!results.empty()) {
+                        result = results.back();
+                    }
                 }
+                outcome.eval_time = std::chrono::steady_clock::now() - eval_start;
 
                 // If eval was canceled, the "after" block was never executed (since it is normally run within the eval
                 // context, and so cancelation unwinds it along with everything else in that context), so we need to run
@@ -659,52 +1375,285 @@ namespace rhost {
                 allow_intr_in_CallBack = true;
             }
 
-            picojson::value parse_status;
-            switch (ps) {
-            case PARSE_NULL:
-                parse_status = picojson::value("NULL");
-                break;
-            case PARSE_OK:
-                parse_status = picojson::value("OK");
-                break;
-            case PARSE_INCOMPLETE:
-                parse_status = picojson::value("INCOMPLETE");
-                break;
-            case PARSE_ERROR:
-                parse_status = picojson::value("ERROR");
-                break;
-            case PARSE_EOF:
-                parse_status = picojson::value("EOF");
-                break;
-            default:
-                parse_status = picojson::value(double(ps));
-                break;
+            outcome.is_canceled = result.is_canceled;
+            if (has_deadline) {
+                // If the deadline expired just as the eval was completing, it might not have been interrupted,
+                // in which case it's reported normally.
+                outcome.deadline_exceeded = clear_eval_deadline(id) && outcome.is_canceled;
             }
 
-            picojson::value error, value;
-            blob blob;
+            outcome.parse_status = parse_status_to_json(ps);
+
             if (result.has_error) {
-                error = picojson::value(Rchar_to_utf8(result.error));
+                outcome.error = picojson::value(Rchar_to_utf8(result.error));
             }
-            if (result.has_value && !no_result) {
+            auto serialize_start = std::chrono::steady_clock::now();
+            if (result.has_value && !ef.no_result) {
                 try {
-                    if (raw_response) {
-                        errors_to_exceptions([&] { to_blob(result.value.get(), blob); });
+                    if (ef.streaming) {
+                        outcome.chunk_count = stream_eval_result(id, result.value.get(), ef.raw_response, outcome.value);
+                    } else if (ef.raw_response) {
+                        // Only validated here; the bytes are read when the response is sent.
+                        const char* data;
+                        size_t size;
+                        to_blob_view(result.value.get(), data, size);
+                        outcome.raw_value = result.value;
                     } else {
-                        errors_to_exceptions([&] { to_json(result.value.get(), value); });
+                        errors_to_exceptions([&] { to_json(result.value.get(), outcome.value); });
                     }
                 } catch (r_error& err) {
                     fatal_error("%s", err.what());
                 }
             }
+            outcome.serialize_time = std::chrono::steady_clock::now() - serialize_start;
+
+            if (ef.metrics) {
+                outcome.gc_count = stats::r_gc_count() - gc_count_before;
+                outcome.gc_time = stats::r_gc_time() - gc_time_before;
+                stats::eval_gc_time.record(outcome.gc_time);
+            }
+
+            stats::eval_parse_time.record(outcome.parse_time);
+            stats::eval_eval_time.record(outcome.eval_time);
+
+            // If callbacks were allowed, a nested eval might have modified the environment halfway through this
+            // one, in which case the outcome doesn't correspond to any single state and shouldn't be memoized.
+            if (memoize && generation == pure_eval_cache_generation && !outcome.is_canceled &&
+                (!outcome.raw_value || static_cast<size_t>(Rf_length(outcome.raw_value.get())) <= pure_eval_cache_max_blob_size)) {
+                auto key = pure_eval_key(expr, ef);
+                auto it = pure_eval_cache_index.find(key);
+                if (it != pure_eval_cache_index.end()) {
+                    pure_eval_cache.erase(it->second);
+                    pure_eval_cache_index.erase(it);
+                } else if (pure_eval_cache.size() >= pure_eval_cache_capacity) {
+                    pure_eval_cache_index.erase(pure_eval_cache.back().first);
+                    pure_eval_cache.pop_back();
+                }
+                pure_eval_cache.emplace_front(key, outcome);
+                pure_eval_cache_index[key] = pure_eval_cache.begin();
+            }
+
+            return outcome;
+        }
+
+#ifndef _WIN32
+        // Runs in the child process forked by handle_forked_eval, and never returns to the caller. The outcome is written
+        // to result_fd as the JSON text of the response arguments, followed by a null character, followed by the blob.
+        RHOST_NORETURN void run_forked_eval(const std::string& expr, const eval_flags& ef, int result_fd) {
+            prepare_forked_child();
+
+            {
+                picojson::value parse_status, error, value;
+                const char* raw_data = nullptr;
+                size_t raw_size = 0;
+
+                protected_sexp eval_env(ef.new_env ? Rf_NewEnvironment(R_NilValue, R_NilValue, ef.env) : ef.env);
+                ParseStatus ps;
+                auto parsed = r_parse(expr, ps, ef.cache_mode);
+                parse_status = parse_status_to_json(ps);
+
+                r_eval_result<protected_sexp> result = {};
+                if (ps == PARSE_OK) {
+                    auto results = r_try_eval(parsed.get(), eval_env.get(), [] {}, [] {});
+                    if (!results.empty()) {
+                        result = results.back();
+                    }
+                }
+
+                if (result.has_error) {
+                    error = picojson::value(Rchar_to_utf8(result.error));
+                }
+                if (result.has_value && !ef.no_result) {
+                    // Unlike in the host, where it is fatal, an unserializable value is reported as an error of the eval,
+                    // since there's no way to report a fatal error from the child.
+                    try {
+                        if (ef.raw_response) {
+                            to_blob_view(result.value.get(), raw_data, raw_size);
+                        } else {
+                            errors_to_exceptions([&] { to_json(result.value.get(), value); });
+                        }
+                    } catch (r_error& err) {
+                        error = picojson::value(err.what());
+                    }
+                }
+
+                auto json = picojson::value(picojson::array{ parse_status, error, value }).serialize();
+                if (write_all(result_fd, json.c_str(), json.size() + 1)) {
+                    write_all(result_fd, raw_data, raw_size);
+                }
+            }
+
+            _exit(EXIT_SUCCESS);
+        }
+#endif
+
+        // Handles an eval with the 'f' flag, which is evaluated in a child process forked from the host, so that R in
+        // the host remains free to handle other requests and the REPL, while it's running. The child has a copy-on-write
+        // snapshot of R state as of the moment the request was handled, and nothing that the eval does to that state is
+        // visible in the host. Callbacks are not available in the child, and any console output is discarded.
+        //
+        // Only the R thread survives the fork, so any host lock that another thread (transport, notifications, blob
+        // requests, ...) held at that moment stays locked forever in the child. Anything that could take such a lock
+        // must not be reachable from the eval: notifications are no-ops, and Microsoft.R.Host::Call.* exports that use
+        // blobs, host stats or requests to the client fail immediately with an R error (see check_not_forked_child).
+        //
+        // The response is the same as for the eval without 'f'. If max_forked_evals are already running, the response is
+        // [null, "BUSY"]; if the child could not be forked, or terminated without producing a result, it's [null, "FORK_FAILED"].
+        // "!/" for the eval, or its deadline expiring, kills the child, regardless of whether it was requested as cancelable;
+        // "!//" does not affect forked evals.
+        void handle_forked_eval(const message& msg, const std::string& expr, const eval_flags& ef, std::chrono::steady_clock::duration timeout) {
+#ifdef _WIN32
+            logf(log_verbosity::minimal, "#%llu# Forked evaluation is not supported on Windows.\n", msg.id());
+            respond_to_message(msg, picojson::value(), "FORK_FAILED");
+#else
+            auto id = msg.id();
+            int fds[2];
+            pid_t pid;
+            {
+                // The lock is held across the fork, so that the child is in forked_evals before anything can try to
+                // cancel it, or to reap it.
+                std::lock_guard<std::mutex> lock(forked_evals_mutex);
+                if (forked_evals.size() >= max_forked_evals) {
+                    respond_to_message(msg, picojson::value(), "BUSY");
+                    return;
+                }
+
+                if (pipe2(fds, O_CLOEXEC) != 0) {
+                    logf(log_verbosity::minimal, "#%llu# Couldn't create pipe for forked eval: %s\n", id, strerror(errno));
+                    respond_to_message(msg, picojson::value(), "FORK_FAILED");
+                    return;
+                }
+
+                pid = fork();
+                if (pid == 0) {
+                    close(fds[0]);
+                    run_forked_eval(expr, ef, fds[1]);
+                }
+
+                close(fds[1]);
+                if (pid < 0) {
+                    logf(log_verbosity::minimal, "#%llu# Couldn't fork eval process: %s\n", id, strerror(errno));
+                    close(fds[0]);
+                    respond_to_message(msg, picojson::value(), "FORK_FAILED");
+                    return;
+                }
+
+                forked_evals[id] = forked_eval_info{ pid, false };
+            }
+
+            logf(log_verbosity::traffic, "#%llu# Evaluating in process %d.\n", id, pid);
+
+            bool has_deadline = timeout > std::chrono::steady_clock::duration::zero();
+            if (has_deadline) {
+                set_eval_deadline(id, std::chrono::steady_clock::now() + timeout);
+            }
+
+            std::string response_name = msg.name();
+            response_name[0] = ':';
+            int result_fd = fds[0];
+
+            std::thread([=] {
+                std::string output;
+                read_all(result_fd, output);
+                close(result_fd);
+
+                bool is_canceled;
+                {
+                    std::lock_guard<std::mutex> lock(forked_evals_mutex);
+                    auto it = forked_evals.find(id);
+                    is_canceled = it->second.is_canceled;
+                    forked_evals.erase(it);
+                }
+
+                int status;
+                while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+                }
+
+                bool deadline_exceeded = has_deadline && clear_eval_deadline(id);
+
+                auto error_json = [](const char* error) {
+                    return picojson::value(picojson::array{ picojson::value(), picojson::value(error) }).serialize();
+                };
+
+                std::string json;
+                const char* blob_data = nullptr;
+                size_t blob_size = 0;
+                auto json_end = output.find('\0');
+                if (deadline_exceeded) {
+                    json = error_json("DEADLINE_EXCEEDED");
+                } else if (is_canceled) {
+                    json = picojson::value(picojson::array{ picojson::value() }).serialize();
+                } else if (json_end == std::string::npos) {
+                    logf(log_verbosity::minimal, "#%llu# Eval process %d terminated without producing a result.\n", id, pid);
+                    json = error_json("FORK_FAILED");
+                } else {
+                    json.assign(output, 0, json_end);
+                    blob_data = output.data() + json_end + 1;
+                    blob_size = output.size() - json_end - 1;
+                }
+
+                message response(id, response_name, json, nullptr, 0);
+                reset_idle_timer();
+                transport::send_message(response, blob_data, blob_size);
+            }).detach();
+#endif
+        }
+
+        void handle_eval(const message& msg) {
+            assert(msg.name()[0] == '?' && msg.name()[1] == '=');
+
+            auto args = msg.json();
+            if (args.size() < 1 || args.size() > 2 || !args[0].is<std::string>()) {
+                fatal_error("Invalid evaluation request #%llu#: must have form [expr] or [expr, timeout].", msg.id());
+            }
+
+            const auto& expr = from_utf8(args[0].get<std::string>());
+            log::logf(log_verbosity::traffic, "#%llu# = %s\n\n", msg.id(), expr.c_str());
+
+            auto ef = parse_eval_flags(msg.name(), msg.name() + 2);
+            auto timeout = parse_eval_timeout(msg, args.size() > 1 ? args[1] : picojson::value());
+            if (ef.forked) {
+                handle_forked_eval(msg, expr, ef, timeout);
+                return;
+            }
+
+            auto outcome = evaluate(msg.id(), expr, ef, timeout);
 
 #ifdef TRACE_JSON
             indent_log(+1);
 #endif
-            if (result.is_canceled) {
-                respond_to_message(msg, picojson::value());
+            // Building the response includes producing the JSON text, so it's accounted as part of serialization.
+            auto serialize_start = std::chrono::steady_clock::now();
+            message response;
+            const char* raw_data = nullptr;
+            size_t raw_size = 0;
+            if (outcome.deadline_exceeded) {
+                response = make_response(msg, blob(), picojson::value(), "DEADLINE_EXCEEDED");
+            } else if (outcome.is_canceled) {
+                response = make_response(msg, blob(), picojson::value());
+            } else if (ef.streaming) {
+                // Terminates the sequence of "!EvalChunk" notifications, if there were any.
+                response = make_response(msg, blob(), outcome.parse_status, outcome.error, outcome.value, static_cast<double>(outcome.chunk_count));
             } else {
-                respond_to_message(msg, blob, parse_status, error, value);
+                response = make_response(msg, blob(), outcome.parse_status, outcome.error, outcome.value);
+                if (outcome.raw_value) {
+                    to_blob_view(outcome.raw_value.get(), raw_data, raw_size);
+                }
+            }
+            auto send_start = std::chrono::steady_clock::now();
+            outcome.serialize_time += send_start - serialize_start;
+
+            reset_idle_timer();
+            transport::send_message(response, raw_data, raw_size);
+            auto send_time = std::chrono::steady_clock::now() - send_start;
+
+            size_t result_size = response.payload().size() + raw_size;
+            stats::eval_serialize_time.record(outcome.serialize_time);
+            stats::eval_send_time.record(send_time);
+            stats::eval_result_size.record(result_size);
+
+            if (ef.metrics) {
+                send_eval_metrics(msg.id(), outcome, send_time, result_size);
             }
 #ifdef TRACE_JSON
             indent_log(-1);
@@ -720,6 +1669,94 @@ namespace rhost {
             }
         }
 
+        // Handles "?=*" - a batch of evals, which are executed sequentially and reported in a single response.
+        // Arguments are [[flags, expr, timeout], ...], where flags are the same as those that can follow "?=",
+        // except for 'r' (the response can only carry a single blob), and timeout is optional. The response has
+        // one element per item, which is either [parse_status, error, value] as in the response to "?=", null
+        // if the item was canceled, or [null, "DEADLINE_EXCEEDED"] if it ran out of time.
+        //
+        // All items are registered on the eval stack under the ID of the batch message, so "!/" for that ID
+        // cancels whichever item is executing at the time, if that item is cancelable. When an item is canceled,
+        // the remaining items are not executed, and are reported as canceled as well. An item exceeding its
+        // deadline does not affect the items that follow it.
+        void handle_eval_batch(const message& msg) {
+            assert(!strcmp(msg.name(), "?=*"));
+
+            auto args = msg.json();
+
+            struct batch_item {
+                eval_flags ef;
+                std::string expr;
+                std::chrono::steady_clock::duration timeout;
+            };
+
+            std::vector<batch_item> items;
+            items.reserve(args.size());
+            for (const auto& arg : args) {
+                if (!arg.is<picojson::array>()) {
+                    fatal_error("Invalid batch evaluation request #%llu#: must have form [[flags, expr, timeout], ...].", msg.id());
+                }
+
+                const auto& item = arg.get<picojson::array>();
+                if (item.size() < 2 || item.size() > 3 || !item[0].is<std::string>() || !item[1].is<std::string>()) {
+                    fatal_error("Invalid batch evaluation request #%llu#: must have form [[flags, expr, timeout], ...].", msg.id());
+                }
+
+                auto ef = parse_eval_flags(msg.name(), item[0].get<std::string>().c_str());
+                if (ef.raw_response || ef.streaming || ef.metrics || ef.forked) {
+                    fatal_error("'%s': flags 'r', 's', 'm' and 'f' are not supported in batch evaluation.", msg.name());
+                }
+
+                auto timeout = parse_eval_timeout(msg, item.size() > 2 ? item[2] : picojson::value());
+                items.push_back(batch_item{ ef, from_utf8(item[1].get<std::string>()), timeout });
+            }
+
+            picojson::array results;
+            results.reserve(items.size());
+
+            bool is_canceled = false;
+            for (const auto& item : items) {
+                if (is_canceled) {
+                    results.push_back(picojson::value());
+                    continue;
+                }
+
+                log::logf(log_verbosity::traffic, "#%llu# =* %s\n\n", msg.id(), item.expr.c_str());
+                auto outcome = evaluate(msg.id(), item.expr, item.ef, item.timeout);
+
+                if (outcome.deadline_exceeded) {
+                    picojson::array result;
+                    append(result, picojson::value(), "DEADLINE_EXCEEDED");
+                    results.push_back(picojson::value(std::move(result)));
+                } else if (outcome.is_canceled) {
+                    is_canceled = true;
+                    results.push_back(picojson::value());
+                } else {
+                    picojson::array result;
+                    append(result, outcome.parse_status, outcome.error, outcome.value);
+                    results.push_back(picojson::value(std::move(result)));
+                }
+
+                // Stop early if cancellation of something further down the eval stack is still in progress.
+                if (query_interrupt()) {
+                    is_canceled = true;
+                }
+            }
+
+#ifdef TRACE_JSON
+            indent_log(+1);
+#endif
+            respond_to_message(msg, results);
+#ifdef TRACE_JSON
+            indent_log(-1);
+#endif
+
+            // See the corresponding comment in handle_eval.
+            if (query_interrupt()) {
+                throw eval_cancel_error();
+            }
+        }
+
         void handle_cancel(const std::string& name, const message& msg) {
             assert(name == "!/" || name == "!//");
             auto args = msg.json();
@@ -737,25 +1774,7 @@ namespace rhost {
                 eval_id = static_cast<message_id>(args[0].get<double>());
             }
 
-            std::lock_guard<std::mutex> lock(eval_stack_mutex);
-
-            for (auto eval_info : eval_stack) {
-                auto& id = eval_info.id;
-
-                if (canceling_eval && id == eval_cancel_target) {
-                    // If we're already in the process of cancelling some eval, and that one is below the
-                    // one that we're been asked to cancel in the stack, then we don't need to do anything.
-                    break;
-                }
-
-                if (id == eval_id) {
-                    canceling_eval = true;
-                    eval_cancel_target = id;
-                    break;
-                }
-            }
-
-            if (canceling_eval) {
+            if (cancel_eval(eval_id)) {
                 // Spin the loop in send_request_and_get_response so that it gets a chance to run cancel checks.
                 unblock_message_loop();
             } else {
@@ -774,23 +1793,555 @@ namespace rhost {
             throw;
         }
 
-        void handle_pending_evals() {
-            for (;;) {
-                message msg;
-                {
-                    std::lock_guard<std::mutex> lock(eval_requests_mutex);
-                    if (eval_requests.empty()) {
-                        break;
-                    } else {
-                        msg = eval_requests.front();
-                        eval_requests.pop();
+        // Handles "?Checkpoint" - writes the workspace to an RData file without waiting for the write to complete
+        // (see checkpoint::start). Arguments are [path, compress], where path is null to use the file specified by
+        // --rhost-rdata, and compress is optional, and is null, "gzip", "bzip2", "xz" or "none". Once the file is
+        // written, the response is [null, seconds]; if that fails, it is [error, seconds] instead. If an earlier
+        // checkpoint is still being written, the response is ["BUSY", 0] right away.
+        //
+        // Like evals, these requests are queued and handled on the R thread, so that the snapshot always reflects
+        // the state of R as seen by evals requested before and after it.
+        void handle_checkpoint(message&& msg) {
+            assert(!strcmp(msg.name(), "?Checkpoint"));
+
+            auto args = msg.json();
+            if (args.size() < 1 || args.size() > 2) {
+                fatal_error("Checkpoint: 1 or 2 arguments expected");
+            }
+
+            fs::path path = rdata;
+            if (args[0].is<std::string>()) {
+                path = args[0].get<std::string>();
+            } else if (!args[0].is<picojson::null>()) {
+                fatal_error("Checkpoint: path must be a string or null");
+            }
+
+            std::string compress;
+            if (args.size() > 1 && !args[1].is<picojson::null>()) {
+                compress = args[1].is<std::string>() ? args[1].get<std::string>() : "";
+                if (compress != "gzip" && compress != "bzip2" && compress != "xz" && compress != "none") {
+                    fatal_error("Checkpoint: compress must be null, 'gzip', 'bzip2', 'xz' or 'none'");
+                }
+            }
+
+            if (path.empty()) {
+                respond_to_message(msg, "No path specified, and no RData file was specified for this host.", 0.0);
+                return;
+            }
+
+            // The request outlives this function, since the response is sent once the checkpoint is written.
+            auto request = std::make_shared<message>(std::move(msg));
+            bool started = checkpoint::start(path, compress, [request](const std::string& error, std::chrono::duration<double> elapsed) {
+                picojson::value error_json = error.empty() ? picojson::value() : picojson::value(error);
+                respond_to_message(*request, error_json, elapsed.count());
+            });
+            if (!started) {
+                respond_to_message(*request, "BUSY", 0.0);
+            }
+        }
+
+        // Evaluates an expression that is an argument of a request, in the global environment. If that fails, returns
+        // false and a description of the problem in error. The expression is arbitrary R code that could modify any
+        // environment, so memoized pure evals are invalidated.
+        bool eval_expression(const std::string& expr, protected_sexp& value, std::string& error) {
+            invalidate_pure_eval_cache();
+
+            ParseStatus ps;
+            auto results = r_try_eval(from_utf8(expr), R_GlobalEnv, ps, [] {}, [] {});
+            if (ps != PARSE_OK || results.empty()) {
+                error = "Couldn't parse expression.";
+                return false;
+            }
+
+            auto& result = results.back();
+            if (result.has_error) {
+                error = Rchar_to_utf8(result.error);
+                return false;
+            }
+            if (!result.has_value) {
+                error = "Expression did not produce a value.";
+                return false;
+            }
+
+            value = std::move(result.value);
+            return true;
+        }
+
+        // Evaluates an environment argument of a request: null for the global environment, or else an expression that
+        // evaluates to the environment. If that fails, returns false and a description of the problem in error.
+        bool eval_environment(const picojson::value& expr, protected_sexp& env, std::string& error) {
+            if (!expr.is<std::string>()) {
+                env = R_GlobalEnv;
+                return true;
+            }
+
+            if (!eval_expression(expr.get<std::string>(), env, error)) {
+                return false;
+            }
+            if (TYPEOF(env.get()) != ENVSXP) {
+                error = "Expression did not evaluate to an environment.";
+                return false;
+            }
+            return true;
+        }
+
+        // Handles "?WorkspaceSummary [env, offset, count]" - summarizes bindings in an environment without evaluating any
+        // of them (see workspace::summarize), for variable explorers to fetch in a single request. env is null for the
+        // global environment, or else an expression that evaluates to the environment; count is null to get all bindings
+        // from offset onward. The response is [total, items] as produced by workspace::summarize, or [null, error] if env
+        // could not be evaluated.
+        //
+        // Like evals, these requests are queued and handled on the R thread.
+        void handle_workspace_summary(const message& msg) {
+            assert(!strcmp(msg.name(), "?WorkspaceSummary"));
+
+            auto args = msg.json();
+            if (args.size() != 3 || !(args[0].is<picojson::null>() || args[0].is<std::string>()) ||
+                !args[1].is<double>() || !(args[2].is<picojson::null>() || args[2].is<double>())) {
+                fatal_error("WorkspaceSummary: must have form [env, offset, count]");
+            }
+
+            auto offset = static_cast<size_t>(args[1].get<double>());
+            auto count = args[2].is<double>() ? static_cast<size_t>(args[2].get<double>()) : std::numeric_limits<size_t>::max();
+
+            protected_sexp env;
+            std::string error;
+            if (!eval_environment(args[0], env, error)) {
+                respond_to_message(msg, picojson::value(), error);
+                return;
+            }
+
+            picojson::value summary;
+            try {
+                errors_to_exceptions([&] { summary = workspace::summarize(env.get(), offset, count); });
+            } catch (r_error& err) {
+                respond_to_message(msg, picojson::value(), err.what());
+                return;
+            }
+            const auto& total_and_items = summary.get<picojson::array>();
+            respond_to_message(msg, total_and_items[0], total_and_items[1]);
+        }
+
+        // Handles "?GridFetch [obj, row_start, row_count, col_start, col_count, options]" - fetches a window of a data frame
+        // or a matrix for a data viewer, in binary form (see grid::fetch). obj is either an expression that produces the
+        // object, in which case the object is pinned, or the pin ID returned by an earlier fetch; options is null or
+        // {"max_string_length": n, "format_classed": bool}. If the pinned object was sorted or filtered via "?GridView",
+        // rows are taken from that view. The response is [pin, nrow, ncol, row_names, columns] as produced by
+        // grid::fetch, with the window data in the blob; or [null, error] if the object could not be fetched,
+        // with error being "NOT_PINNED" if obj is an ID that is no longer pinned.
+        //
+        // Like evals, these requests are queued and handled on the R thread.
+        void handle_grid_fetch(const message& msg) {
+            assert(!strcmp(msg.name(), "?GridFetch"));
+
+            auto args = msg.json();
+            if (args.size() != 6 || !(args[0].is<std::string>() || args[0].is<double>()) ||
+                !args[1].is<double>() || !args[2].is<double>() || !args[3].is<double>() || !args[4].is<double>() ||
+                !(args[5].is<picojson::null>() || args[5].is<picojson::object>())) {
+                fatal_error("GridFetch: must have form [obj, row_start, row_count, col_start, col_count, options]");
+            }
+
+            grid::fetch_options options;
+            if (args[5].is<picojson::object>()) {
+                const auto& max_string_length = args[5].get("max_string_length");
+                if (max_string_length.is<double>()) {
+                    options.max_string_length = static_cast<size_t>(max_string_length.get<double>());
+                }
+                const auto& format_classed = args[5].get("format_classed");
+                if (format_classed.is<bool>()) {
+                    options.format_classed = format_classed.get<bool>();
+                }
+            }
+
+            uint64_t pin;
+            if (args[0].is<std::string>()) {
+                protected_sexp value;
+                std::string error;
+                if (!eval_expression(args[0].get<std::string>(), value, error)) {
+                    respond_to_message(msg, picojson::value(), error);
+                    return;
+                }
+                pin = grid::pin(value.get());
+            } else {
+                pin = static_cast<uint64_t>(args[0].get<double>());
+                if (!grid::get_pinned(pin)) {
+                    respond_to_message(msg, picojson::value(), "NOT_PINNED");
+                    return;
+                }
+            }
+
+            // Some columns are formatted by calling format(), which can dispatch to arbitrary R methods.
+            invalidate_pure_eval_cache();
+
+            blob data;
+            picojson::value window;
+            try {
+                errors_to_exceptions([&] {
+                    window = grid::fetch(pin,
+                        static_cast<size_t>(args[1].get<double>()), static_cast<size_t>(args[2].get<double>()),
+                        static_cast<size_t>(args[3].get<double>()), static_cast<size_t>(args[4].get<double>()),
+                        options, data);
+                });
+            } catch (r_error& err) {
+                if (args[0].is<std::string>()) {
+                    // The client never learns the pin ID in this case, so it can't unpin it.
+                    grid::unpin(pin);
+                }
+                respond_to_message(msg, picojson::value(), err.what());
+                return;
+            }
+
+            const auto& window_args = window.get<picojson::array>();
+            auto response = make_response(msg, blob(), static_cast<double>(pin), window_args[0], window_args[1], window_args[2], window_args[3]);
+            reset_idle_timer();
+            transport::send_message(response, data.data(), data.size());
+        }
+
+        // Handles "?GridView [pin, sort, filters]" - sorts and/or filters rows of a pinned object natively (see
+        // grid::set_view), so that subsequent "?GridFetch" requests for that pin page through the result. sort is
+        // [[column, descending], ...], and filters are [[column, op, operand], ...], where columns are 0-based; if
+        // both are empty, the view is reset. The response is [nrow], the number of rows in the view, or [null, error],
+        // with error being "NOT_PINNED" if there's no such pinned object. Strings are sorted bytewise, which is not
+        // the locale-specific order of order().
+        //
+        // Like evals, these requests are queued and handled on the R thread.
+        void handle_grid_view(const message& msg) {
+            assert(!strcmp(msg.name(), "?GridView"));
+
+            auto args = msg.json();
+            if (args.size() != 3 || !args[0].is<double>() || !args[1].is<picojson::array>() || !args[2].is<picojson::array>()) {
+                fatal_error("GridView: must have form [pin, sort, filters]");
+            }
+
+            std::vector<grid::sort_spec> sort;
+            for (const auto& key : args[1].get<picojson::array>()) {
+                if (!key.is<picojson::array>() || key.get<picojson::array>().size() != 2 ||
+                    !key.get(0).is<double>() || !key.get(1).is<bool>()) {
+                    fatal_error("GridView: sort key must have form [column, descending]");
+                }
+                sort.push_back(grid::sort_spec{ static_cast<size_t>(key.get(0).get<double>()), key.get(1).get<bool>() });
+            }
+
+            std::vector<grid::filter_spec> filters;
+            for (const auto& filter : args[2].get<picojson::array>()) {
+                if (!filter.is<picojson::array>() || filter.get<picojson::array>().size() != 3 ||
+                    !filter.get(0).is<double>() || !filter.get(1).is<std::string>()) {
+                    fatal_error("GridView: filter must have form [column, op, operand]");
+                }
+                filters.push_back(grid::filter_spec{ static_cast<size_t>(filter.get(0).get<double>()), filter.get(1).get<std::string>(), filter.get(2) });
+            }
+
+            auto pin = static_cast<uint64_t>(args[0].get<double>());
+            if (!grid::get_pinned(pin)) {
+                respond_to_message(msg, picojson::value(), "NOT_PINNED");
+                return;
+            }
+
+            size_t nrow = 0;
+            std::string error;
+            bool ok = false;
+            try {
+                errors_to_exceptions([&] { ok = grid::set_view(pin, sort, filters, nrow, error); });
+            } catch (r_error& err) {
+                error = err.what();
+            }
+
+            if (ok) {
+                respond_to_message(msg, static_cast<double>(nrow));
+            } else {
+                respond_to_message(msg, picojson::value(), error);
+            }
+        }
+
+        // Handles "?GridStats [pin, columns, bins]" - summarizes columns of a pinned object (see grid::summarize_columns),
+        // where columns is an array of 0-based column indices, or null for all columns, and bins is the number of
+        // histogram bins. The response is the array of column summaries, or [null, error], with error being
+        // "NOT_PINNED" if there's no such pinned object, or "CANCELED" if the request was canceled via "!/" with its ID.
+        //
+        // Like evals, these requests are queued and handled on the R thread.
+        void handle_grid_stats(const message& msg) {
+            assert(!strcmp(msg.name(), "?GridStats"));
+
+            auto args = msg.json();
+            if (args.size() != 3 || !args[0].is<double>() || !(args[1].is<picojson::null>() || args[1].is<picojson::array>()) ||
+                !args[2].is<double>()) {
+                fatal_error("GridStats: must have form [pin, columns, bins]");
+            }
+
+            std::vector<size_t> columns;
+            if (args[1].is<picojson::array>()) {
+                for (const auto& column : args[1].get<picojson::array>()) {
+                    if (!column.is<double>()) {
+                        fatal_error("GridStats: columns must be numbers");
                     }
+                    columns.push_back(static_cast<size_t>(column.get<double>()));
                 }
+            }
+
+            const size_t max_bins = 1024;
+            auto bins = std::min(static_cast<size_t>(args[2].get<double>()), max_bins);
+
+            auto pin = static_cast<uint64_t>(args[0].get<double>());
+            if (!grid::get_pinned(pin)) {
+                respond_to_message(msg, picojson::value(), "NOT_PINNED");
+                return;
+            }
 
-                handle_eval(msg);
+            auto canceled = std::make_shared<std::atomic<bool>>(false);
+            {
+                std::lock_guard<std::mutex> lock(native_requests_mutex);
+                native_requests[msg.id()] = canceled;
+            }
+            SCOPE_WARDEN(remove_native_request, {
+                std::lock_guard<std::mutex> lock(native_requests_mutex);
+                native_requests.erase(msg.id());
+            });
+
+            picojson::value result;
+            std::string error;
+            bool ok = false;
+            try {
+                errors_to_exceptions([&] {
+                    ok = grid::summarize_columns(pin, args[1].is<picojson::array>() ? &columns : nullptr, bins, *canceled, result, error);
+                });
+            } catch (r_error& err) {
+                error = err.what();
+            }
+
+            if (ok) {
+                respond_to_message(msg, result);
+            } else {
+                respond_to_message(msg, picojson::value(), error);
             }
         }
 
+        // Handles "!GridUnpin [pin]" - releases an object pinned by "?GridFetch". Queued like "?GridFetch", so that it's
+        // ordered with respect to fetches from the same object.
+        void handle_grid_unpin(const message& msg) {
+            assert(!strcmp(msg.name(), "!GridUnpin"));
+
+            auto args = msg.json();
+            if (args.size() != 1 || !args[0].is<double>()) {
+                fatal_error("GridUnpin: must have form [pin]");
+            }
+
+            grid::unpin(static_cast<uint64_t>(args[0].get<double>()));
+        }
+
+        // Environments whose bindings are tracked between prompts, as requested by the client via "?TrackWorkspace",
+        // each with the environment argument that identifies it in "!WorkspaceChanges". Only used on the R thread.
+        std::vector<std::pair<picojson::value, std::unique_ptr<workspace::binding_tracker>>> workspace_trackers;
+
+        // Handles "?TrackWorkspace [env, ...]" - replaces the set of tracked environments, where every env is null for
+        // the global environment, or else an expression that evaluates to the environment, same as for
+        // "?WorkspaceSummary". An empty array stops tracking altogether. The response has an error for every env that
+        // could not be evaluated, or null if it's tracked from now on.
+        //
+        // Whenever the host is about to issue "?>", it first sends "!WorkspaceChanges [[env, added, removed, changed], ...]"
+        // listing names of symbols that were bound, unbound, or rebound in tracked environments since the previous
+        // prompt (or since they were tracked), for those environments where anything did change. The client can use
+        // that to only refetch bindings that changed, but see workspace::binding_tracker for what is not detected.
+        //
+        // Like evals, these requests are queued and handled on the R thread.
+        void handle_track_workspace(const message& msg) {
+            assert(!strcmp(msg.name(), "?TrackWorkspace"));
+
+            auto args = msg.json();
+            for (const auto& arg : args) {
+                if (!arg.is<picojson::null>() && !arg.is<std::string>()) {
+                    fatal_error("TrackWorkspace: every argument must be null or string");
+                }
+            }
+
+            workspace_trackers.clear();
+
+            picojson::array errors;
+            for (const auto& arg : args) {
+                protected_sexp env;
+                std::string error;
+                if (eval_environment(arg, env, error)) {
+                    workspace_trackers.emplace_back(arg, std::make_unique<workspace::binding_tracker>(env.get()));
+                    errors.push_back(picojson::value());
+                } else {
+                    errors.push_back(picojson::value(error));
+                }
+            }
+
+            respond_to_message(msg, picojson::value(std::move(errors)));
+        }
+
+        void send_workspace_changes() {
+            if (workspace_trackers.empty()) {
+                return;
+            }
+
+            auto start_time = std::chrono::steady_clock::now();
+
+            picojson::array changes;
+            for (auto& tracker : workspace_trackers) {
+                picojson::array added, removed, changed;
+                if (tracker.second->update(added, removed, changed)) {
+                    changes.push_back(picojson::value(picojson::array{
+                        tracker.first, picojson::value(std::move(added)), picojson::value(std::move(removed)), picojson::value(std::move(changed))
+                    }));
+                }
+            }
+
+            stats::workspace_tracking_time.record(std::chrono::steady_clock::now() - start_time);
+
+            if (!changes.empty()) {
+                send_notification("!WorkspaceChanges", changes);
+            }
+        }
+
+        // Set by checkpoint_timer_thread when a periodic checkpoint is due. The checkpoint itself is then started by
+        // the R thread once it's idle at the prompt, so that it never captures the effects of a half-completed eval.
+        std::atomic<bool> is_checkpoint_due(false);
+
+        void checkpoint_timer_thread(std::chrono::seconds interval) {
+            for (;;) {
+                std::this_thread::sleep_for(interval);
+                is_checkpoint_due = true;
+                unblock_message_loop();
+            }
+        }
+
+        void start_periodic_checkpoint() {
+            if (!is_checkpoint_due || !is_idle_at_prompt()) {
+                return;
+            }
+            is_checkpoint_due = false;
+
+            // If the previous periodic checkpoint is taking longer than the interval, skip this one.
+            auto path = rdata;
+            checkpoint::start(path, std::string(), [path](const std::string& error, std::chrono::duration<double> elapsed) {
+                picojson::value error_json = error.empty() ? picojson::value() : picojson::value(error);
+                send_notification("!Checkpoint", path.string(), error_json, elapsed.count());
+            });
+        }
+
+        // Set whenever R code might have attached something to the search path or loaded a namespace since the symbol
+        // index was last updated, or if the last update ran out of time. Only used on the R thread.
+        bool is_completion_index_stale = true;
+
+        // Updates the symbol index (see completions::update) once R is idle at the prompt. This is done a little at a
+        // time, so that evals that are requested while it's being built are not held up for long.
+        void update_completion_index() {
+            if (!is_completion_index_stale || !is_idle_at_prompt()) {
+                return;
+            }
+
+            is_completion_index_stale = completions::update(std::chrono::steady_clock::now() + 10ms);
+#ifdef _WIN32
+            if (is_completion_index_stale) {
+                // Otherwise, the message loop would block in R_WaitEvent until something else comes in.
+                PostThreadMessage(main_thread_id, WM_NULL, 0, 0);
+            }
+#endif
+        }
+
+        // Raised by the memory monitor (on its own thread) to the new pressure level whenever that goes up. The R thread
+        // then frees what it can once it's idle, and resets it back to normal.
+        std::atomic<memory::pressure_level> memory_relief_due(memory::pressure_level::normal);
+
+        // Set while requests are being dispatched by handle_pending_evals. Only used on the R thread.
+        bool is_handling_requests = false;
+
+        void memory_level_changed(memory::pressure_level level, memory::pressure_level previous, const memory::status& st) {
+            logf(log_verbosity::minimal, "Memory pressure went from %s to %s; %lld of %lld bytes used, RSS is %lld bytes.\n",
+                memory::to_string(previous), memory::to_string(level),
+                static_cast<long long>(st.used), static_cast<long long>(st.limit), static_cast<long long>(st.rss));
+
+            post_notification("!MemoryPressure", picojson::array{ picojson::value(memory::to_string(level)), memory::to_json(st) }, "!MemoryPressure");
+
+            if (level > previous) {
+                auto due = memory_relief_due.load();
+                while (due < level && !memory_relief_due.compare_exchange_weak(due, level)) {
+                }
+                unblock_message_loop();
+            }
+        }
+
+        // Frees what memory can be freed after the memory monitor has raised the pressure level. A full GC is always
+        // done; at the critical level, host-side caches that can be rebuilt on demand are dropped first, so that the
+        // GC can collect what they were holding on to. Client-owned blobs are left alone, since the client still
+        // refers to them by ID.
+        //
+        // Nothing is done while an eval or a request is running: R collects garbage by itself whenever an eval needs
+        // memory, so a forced full GC and malloc_trim would only stall the eval further; and the request might be
+        // using a pinned object or a snapshot. Relief is left due until the R thread is idle at the prompt.
+        void relieve_memory_pressure() {
+            if (is_handling_requests || !is_idle_at_prompt()) {
+                return;
+            }
+
+            auto level = memory_relief_due.exchange(memory::pressure_level::normal);
+            if (level == memory::pressure_level::normal) {
+                return;
+            }
+
+            auto start_time = std::chrono::steady_clock::now();
+            size_t pins = 0, snapshots = 0;
+
+            if (level == memory::pressure_level::critical) {
+                invalidate_pure_eval_cache();
+                clear_parse_cache();
+                pins = grid::unpin_all();
+                snapshots = grdevices::ide::drop_inactive_snapshots();
+            }
+
+            r_top_level_exec([] { R_gc(); });
+#ifdef __GLIBC__
+            // Hand free pages back to the system, so that they no longer count towards the limit.
+            malloc_trim(0);
+#endif
+
+            stats::memory_relief_time.record(std::chrono::steady_clock::now() - start_time);
+            logf(log_verbosity::minimal, "Relieved memory pressure: dropped %zu pinned objects and %zu plot snapshots; RSS is now %lld bytes.\n",
+                pins, snapshots, static_cast<long long>(memory::get_status().rss));
+        }
+
+        void handle_pending_evals() {
+            relieve_memory_pressure();
+            start_periodic_checkpoint();
+            update_completion_index();
+
+            if (eval_requests.empty()) {
+                return;
+            }
+
+            SCOPE_WARDEN_RESTORE(is_handling_requests);
+            is_handling_requests = true;
+
+            for (queued_eval qe; eval_requests.try_pop(qe);) {
+                stats::eval_queue_length.fetch_sub(1, std::memory_order_relaxed);
+                stats::eval_queue_wait_time.record(std::chrono::steady_clock::now() - qe.queued_at);
+
+                auto msg = std::move(qe.msg);
+                if (!strcmp(msg.name(), "?=*")) {
+                    handle_eval_batch(msg);
+                } else if (!strcmp(msg.name(), "?Checkpoint")) {
+                    handle_checkpoint(std::move(msg));
+                } else if (!strcmp(msg.name(), "?WorkspaceSummary")) {
+                    handle_workspace_summary(msg);
+                } else if (!strcmp(msg.name(), "?TrackWorkspace")) {
+                    handle_track_workspace(msg);
+                } else if (!strcmp(msg.name(), "?GridFetch")) {
+                    handle_grid_fetch(msg);
+                } else if (!strcmp(msg.name(), "?GridView")) {
+                    handle_grid_view(msg);
+                } else if (!strcmp(msg.name(), "?GridStats")) {
+                    handle_grid_stats(msg);
+                } else if (!strcmp(msg.name(), "!GridUnpin")) {
+                    handle_grid_unpin(msg);
+                } else {
+                    handle_eval(msg);
+                }
+            }
+
+            is_completion_index_stale = true;
+        }
+
         inline message send_request_and_get_response(const std::string& name, const picojson::array& args) {
             assert(name[0] == '?');
 
@@ -826,7 +2377,7 @@ namespace rhost {
                             fatal_error("Invalid response state transition: went from RESPONSE_EXPECTED to RESPONSE_UNEXPECTED.");
                         }
                         if (response_state == RESPONSE_RECEIVED) {
-                            msg = response;
+                            msg = std::move(response);
                             response_state = old_response_state;
                             break;
                         }
@@ -882,12 +2433,117 @@ namespace rhost {
             }
         }
 
-        picojson::array get_context() {
-            picojson::array context;
+        // Whether the client has asked for "?>" to report the context as a delta from the previous prompt.
+        std::atomic<bool> context_delta_enabled(false);
+
+        // A single context in R_GlobalContext chain. Two frames are considered the same context if all of these are
+        // the same, so that a context that was popped and replaced by another one at the same address is not mistaken
+        // for the original - cloenv is a fresh environment for every closure call, and the same next pointer means
+        // that everything below the context is the same as well.
+        struct context_frame {
+            RCNTXT* ctxt;
+            RCNTXT* next;
+            SEXP cloenv;
+            SEXP call;
+            int callflag;
+
+            explicit context_frame(RCNTXT* ctxt)
+                : ctxt(ctxt), next(ctxt->nextcontext), cloenv(ctxt->cloenv), call(ctxt->call), callflag(ctxt->callflag) {
+            }
+
+            bool operator== (const context_frame& other) const {
+                return ctxt == other.ctxt && next == other.next && cloenv == other.cloenv &&
+                    call == other.call && callflag == other.callflag;
+            }
+
+            bool operator!= (const context_frame& other) const {
+                return !(*this == other);
+            }
+        };
+
+        // R_GlobalContext chain as of the last call to get_context, outermost first, and the index of every context
+        // in it. The outer part of the chain rarely changes between prompts, so get_context only needs to walk the
+        // contexts that were pushed since.
+        std::vector<context_frame> context_cache;
+        std::unordered_map<RCNTXT*, size_t> context_cache_index;
+
+        // Context that was last reported on a "?>", outermost first. Only meaningful if is_last_context_valid is
+        // set, i.e. if the client has seen it as well.
+        std::vector<context_frame> last_context;
+        bool is_last_context_valid;
+
+        void set_context_delta(const message& msg) {
+            assert(!strcmp(msg.name(), "!ContextDelta"));
+
+            auto args = msg.json();
+            if (args.size() != 1 || !args[0].is<bool>()) {
+                fatal_error("Incorrect number or type of arguments to '!ContextDelta'.");
+            }
+
+            context_delta_enabled = args[0].get<bool>();
+        }
+
+        // All contexts in R_GlobalContext chain, outermost first.
+        std::vector<context_frame> get_context() {
+            std::vector<context_frame> pushed;
+            size_t keep = 0;
             for (RCNTXT* ctxt = reinterpret_cast<RCNTXT*>(R_GlobalContext); ctxt != nullptr; ctxt = ctxt->nextcontext) {
-                context.push_back(picojson::value(double(ctxt->callflag)));
+                context_frame frame(ctxt);
+                auto it = context_cache_index.find(ctxt);
+                if (it != context_cache_index.end() && context_cache[it->second] == frame) {
+                    keep = it->second + 1;
+                    break;
+                }
+                pushed.push_back(frame);
+            }
+
+            for (size_t i = keep; i < context_cache.size(); ++i) {
+                context_cache_index.erase(context_cache[i].ctxt);
+            }
+            context_cache.erase(context_cache.begin() + keep, context_cache.end());
+
+            for (auto it = pushed.rbegin(); it != pushed.rend(); ++it) {
+                context_cache_index[it->ctxt] = context_cache.size();
+                context_cache.push_back(*it);
             }
-            return context;
+
+            return context_cache;
+        }
+
+        // Call flags of all frames in context except for the outermost keep ones, innermost first.
+        picojson::array context_to_array(const std::vector<context_frame>& context, size_t keep = 0) {
+            picojson::array frames;
+            frames.reserve(context.size() - keep);
+            std::transform(context.rbegin(), context.rend() - keep, std::back_inserter(frames), [](const context_frame& frame) {
+                return picojson::value(static_cast<double>(frame.callflag));
+            });
+            return frames;
+        }
+
+        // Produces the context argument of "?>". Normally, it is an array of call flags, innermost first. If the client
+        // has enabled context deltas, it is {"keep": n, "frames": [...]} instead, meaning that the outermost n frames
+        // of the previously reported context remain, and frames (innermost first) have been pushed on top of them.
+        picojson::value context_to_json(const std::vector<context_frame>& context) {
+            if (!context_delta_enabled) {
+                is_last_context_valid = false;
+                return picojson::value(context_to_array(context));
+            }
+
+            size_t keep = 0;
+            if (is_last_context_valid) {
+                auto mismatch = std::mismatch(context.begin(), context.end(), last_context.begin(), last_context.end());
+                keep = mismatch.first - context.begin();
+            }
+
+            auto frames = context_to_array(context, keep);
+
+            last_context = context;
+            is_last_context_valid = true;
+
+            picojson::object delta;
+            delta["keep"] = picojson::value(static_cast<double>(keep));
+            delta["frames"] = picojson::value(std::move(frames));
+            return picojson::value(std::move(delta));
         }
 
         void do_r_callback(bool allow_eval_interrupt) {
@@ -906,7 +2562,9 @@ namespace rhost {
                 return;
             }
 
-            if (allow_eval_interrupt && query_interrupt()) {
+            if (!allow_eval_interrupt) {
+                retract_stale_interrupt();
+            } else if (query_interrupt()) {
                 allow_intr_in_CallBack = false;
                 interrupt_eval();
                 // Note that allow_intr_in_CallBack is not reset to false here. This is because Rf_onintr
@@ -915,6 +2573,8 @@ namespace rhost {
                 // immediately after r_try_eval returns, or else (if we unwound R's own REPL eval) at
                 // the beginning of the next ReadConsole.
                 assert(!"Rf_onintr should never return.");
+            } else {
+                retract_stale_interrupt();
             }
 
             // Process any pending eval requests if reentrancy is allowed.
@@ -935,18 +2595,24 @@ namespace rhost {
                 // the standard library is not fully loaded yet.
                 {
                     std::lock_guard<std::mutex> lock(is_r_ready_lock);
+                    if (!is_r_ready) {
+                        stats::end_startup_phase("first_prompt");
+                    }
                     is_r_ready = true;
                     is_r_ready_cond.notify_all();
                 }
 
-                if (!allow_intr_in_CallBack) {
+                if (!allow_intr_in_CallBack || consume_interrupt()) {
                     // If we got here, this means that we've just processed a cancellation request that had
                     // unwound the context stack all the way to the bottom, cancelling all the active evals;
                     // otherwise, handle_eval would have allow_intr_in_CallBack set to true immediately after
-                    // the targeted eval had returned. Mark everything cancellation-related as done.
+                    // the targeted eval had returned. If R acted on request_interrupt by itself, the targeted
+                    // eval would have seen that, so it must have been the top-level one as well. Mark
+                    // everything cancellation-related as done.
                     assert(eval_stack.size() == 1);
                     canceling_eval = false;
                     allow_intr_in_CallBack = true;
+                    is_handling_requests = false;
 
                     // Notify client that cancellation has completed. When a specific eval is being canceled,
                     // there will be a corresponding (error) response to the original '?=' message indicating
@@ -954,13 +2620,10 @@ namespace rhost {
                     send_notification("!CanceledAll");
                 }
 
-                bool is_browser = false;
-                for (RCNTXT* ctxt = reinterpret_cast<RCNTXT*>(R_GlobalContext); ctxt != nullptr; ctxt = ctxt->nextcontext) {
-                    if (ctxt->callflag & CTXT_BROWSER) {
-                        is_browser = true;
-                        break;
-                    }
-                }
+                retract_stale_interrupt();
+
+                auto context = get_context();
+                bool is_browser = std::any_of(context.begin(), context.end(), [](const context_frame& frame) { return frame.callflag & CTXT_BROWSER; });
 
                 if (!allow_callbacks && len >= 3) {
                     if (is_browser) {
@@ -990,9 +2653,19 @@ namespace rhost {
 
                 readconsole_done();
 
+                // Report what the input that was returned from the previous prompt did to the tracked environments.
+                send_workspace_changes();
+                is_completion_index_stale = true;
+
+                // Whatever R does with the input once we return it can modify the environment, so any memoized
+                // pure evals become stale from that point on.
+                SCOPE_WARDEN_RESTORE(is_at_prompt);
+                SCOPE_WARDEN(invalidate_pure_evals, { invalidate_pure_eval_cache(); });
+                is_at_prompt = true;
+
                 for (std::string retry_reason;;) {
                     auto msg = send_request_and_get_response(
-                        "?>", get_context(), double(len), addToHistory != 0,
+                        "?>", context_to_json(context), double(len), addToHistory != 0,
                         retry_reason.empty() ? picojson::value() : picojson::value(retry_reason),
                         to_utf8_json(prompt));
 
@@ -1034,7 +2707,7 @@ namespace rhost {
             });
         }
 
-        void message_received(const message& incoming) {
+        void message_received(message& incoming) {
             reset_idle_timer();
 
             // If R is not ready yet, wait until it is before processing any incoming requests
@@ -1061,9 +2734,29 @@ namespace rhost {
                 return write_blob(incoming);
             } else if (name == "!DestroyBlob") {
                 return destroy_blobs(incoming);
-            } else if (name.size() >= 2 && name[0] == '?' && name[1] == '=') {
-                std::lock_guard<std::mutex> lock(eval_requests_mutex);
-                eval_requests.push(incoming);
+            } else if (name == "!ContextDelta") {
+                return set_context_delta(incoming);
+            } else if (name == "?Stats") {
+                return handle_stats(incoming);
+            } else if (name == "?MemoryStatus") {
+                return handle_memory_status(incoming);
+            } else if (name == "?Completions") {
+                return handle_completions(incoming);
+            } else if (name == "?JobSubmit") {
+                return handle_job_submit(incoming);
+            } else if (name == "?JobList") {
+                return handle_job_list(incoming);
+            } else if (name == "!JobCancel") {
+                return handle_job_cancel(incoming);
+            } else if (name == "?JobOutput") {
+                return handle_job_output(incoming);
+            } else if ((name.size() >= 2 && name[0] == '?' && name[1] == '=') ||
+                name == "?Checkpoint" || name == "?WorkspaceSummary" || name == "?TrackWorkspace" ||
+                name == "?GridFetch" || name == "?GridView" || name == "?GridStats" || name == "!GridUnpin") {
+                auto depth = stats::eval_queue_length.fetch_add(1, std::memory_order_relaxed) + 1;
+                stats::eval_queue_depth.record(static_cast<uint64_t>(depth));
+
+                eval_requests.push(queued_eval{ std::move(incoming), std::chrono::steady_clock::now() });
                 unblock_message_loop();
                 return;
             } else if (incoming.is_response()) {
@@ -1098,17 +2791,56 @@ namespace rhost {
             ptr_R_WriteConsoleEx = WriteConsoleEx;
             ptr_R_ShowMessage = ShowMessage;
             ptr_R_Busy = Busy;
+
+            // There's no CallBack on POSIX, but R_PolledEvents is invoked from R_ProcessEvents in the same way,
+            // including right before R_CheckUserInterrupt checks R_interrupts_pending. Chain to whatever handler
+            // was there before, since packages (e.g. tcltk) can install their own.
+            //
+            // Note that this makes every R_CheckUserInterrupt a CallBack, including those made from package C code
+            // that does not expect R code to run. When the running eval was issued with '@', that means queued
+            // evals are dispatched via handle_pending_evals from wherever that C code happens to be; this is the
+            // same as on Windows, where R_ProcessEvents calls CallBack directly. Clients must not use '@' for evals
+            // that call into such code if they also issue evals that change state it depends on.
+            static void (*prev_polled_events)(void) = R_PolledEvents;
+            R_PolledEvents = [] {
+                if (prev_polled_events) {
+                    prev_polled_events();
+                }
+                CallBack();
+            };
+        }
+
+        void prepare_forked_child() {
+            // Other threads of the parent, which may have been holding locks at the moment of the fork, don't exist
+            // in the child; so anything that needs them, or talks to the client, must be cut off before R runs.
+            log::disable_log_in_forked_child();
+            transport::close_in_forked_child();
+            is_forked_child = true;
+
+            // An interrupt that was requested for some eval in the parent is not meant for the child.
+            retract_interrupt();
+
+            R_PolledEvents = [] {};
+            ptr_R_WriteConsoleEx = [](const char*, int, int) {};
+            ptr_R_ShowMessage = [](const char*) {};
+            ptr_R_Busy = [](int) {};
+            ptr_R_ReadConsole = [](const char*, ReadConsole_buf_t*, int, int) { return 0; };
         }
 #endif
 
-        void initialize(structRstart& rp, const fs::path& rdata, std::chrono::seconds idle_timeout) {
+        void initialize(structRstart& rp, const fs::path& rdata, std::chrono::seconds idle_timeout, std::chrono::seconds checkpoint_interval, interrupt_delivery delivery,
+            const memory::thresholds& memory_thresholds) {
             host::rdata = rdata;
+            set_interrupt_delivery(delivery);
 #ifdef _WIN32
             main_thread_id = GetCurrentThreadId();
 #endif
             transport::message_received.connect(message_received);
             transport::disconnected.connect(unblock_message_loop);
 
+            std::thread(deadline_thread).detach();
+            std::thread(posted_notifications_thread).detach();
+
 #ifdef _WIN32
             set_callbacks_windows(rp);
             char* dllVersion = getDLLVersion();
@@ -1123,6 +2855,29 @@ namespace rhost {
                 logf(log_verbosity::minimal, "Host process will shut down after %lld seconds of inactivity.\n", idle_timeout.count());
                 std::thread([&] { idle_timer_thread(idle_timeout); }).detach();
             }
+
+            if (checkpoint_interval > 0s) {
+#ifdef _WIN32
+                logf(log_verbosity::minimal, "Periodic checkpoints are not supported on Windows; ignoring checkpoint interval.\n");
+#else
+                if (rdata.empty()) {
+                    logf(log_verbosity::minimal, "Periodic checkpoints require an RData file; ignoring checkpoint interval.\n");
+                } else {
+                    logf(log_verbosity::minimal, "Workspace will be saved to %s every %lld seconds.\n", rdata.string().c_str(), checkpoint_interval.count());
+                    std::thread(checkpoint_timer_thread, checkpoint_interval).detach();
+                }
+#endif
+            }
+
+            if (memory_thresholds.warning > 0 || memory_thresholds.critical > 0 || memory_thresholds.stall > 0) {
+#ifdef _WIN32
+                logf(log_verbosity::minimal, "Memory monitoring is not supported on Windows; ignoring memory thresholds.\n");
+#else
+                logf(log_verbosity::minimal, "Monitoring memory usage: warning at %.0f%%, critical at %.0f%% of the limit, or at %.0f%% stall time.\n",
+                    memory_thresholds.warning * 100, memory_thresholds.critical * 100, memory_thresholds.stall * 100);
+                memory::start_monitor(memory_thresholds, memory_level_changed);
+#endif
+            }
         }
 
         extern "C" void ShowMessage(const char* s) {
@@ -1137,7 +2892,8 @@ namespace rhost {
                     Rf_error("ShowMessageBox: blocking callback not allowed during evaluation.");
                 }
 
-                auto msg = send_request_and_get_response(cmd, get_context(), to_utf8_json(s));
+                auto context = get_context();
+                auto msg = send_request_and_get_response(cmd, context_to_array(context), to_utf8_json(s));
                 auto args = msg.json();
                 if (args.size() != 1 || !args[0].is<std::string>()) {
                     fatal_error("ShowMessageBox: response argument must be a string.");
@@ -27,15 +27,34 @@
 #include "message.h"
 #include "log.h"
 #include "r_api.h"
+#include "eval.h"
+#include "memory.h"
 
 namespace rhost {
     namespace host {
         class eval_cancel_error : std::exception {
         };
 
-        void initialize(structRstart& rp, const fs::path& rdata, std::chrono::seconds idle_timeout);
+        void initialize(structRstart& rp, const fs::path& rdata, std::chrono::seconds idle_timeout, std::chrono::seconds checkpoint_interval, eval::interrupt_delivery delivery,
+            const memory::thresholds& memory_thresholds);
         void set_callbacks_windows(structRstart& rp);
         void set_callbacks_posix();
+
+#ifndef _WIN32
+        // Must be called in a child process that was forked from the R thread, before it runs any R code. Only the
+        // R thread survives the fork, so the transport and everything else that relies on other threads of the host
+        // is unusable in the child; and the child shares stdout with the parent. This closes the child's copies of
+        // the transport file descriptors, turns logging and sending or posting notifications into no-ops, and
+        // replaces the host callbacks with no-ops, so that R never reaches any of that; requests to the client
+        // raise an R error. The child should exit via _exit once it's done.
+        void prepare_forked_child();
+#endif
+
+        // Raises an R error naming what if called in a child process prepared by prepare_forked_child. Exports that
+        // call host functions which take a host lock (blobs, stats, requests to the client) must call this first:
+        // another thread of the parent may have been holding that lock at the moment of the fork, and in the child,
+        // nothing would ever release it.
+        void check_not_forked_child(const char* what);
         void shutdown_if_requested();
         void do_r_callback(bool allow_eval_interrupt);
 
@@ -76,6 +95,16 @@ namespace rhost {
             return send_notification(name, args_array, blob);
         }
 
+        // Queues a notification to be sent later from a background thread, together with any others queued by then,
+        // and returns immediately. If coalescing_key is not empty and a notification with the same key is still
+        // queued, that notification is replaced with this one. Notifications sent by send_notification are never
+        // sent ahead of notifications that were posted before them.
+        //
+        // This never blocks. If the client falls so far behind that the queue is full, new notifications (other than
+        // those that replace a queued one) are dropped. The client is then sent "!NotificationsDropped [count]"
+        // after the notifications that were queued before them.
+        void post_notification(const std::string& name, picojson::array&& args, const std::string& coalescing_key = std::string());
+
         protocol::message send_request_and_get_response(const std::string&, const picojson::array& args);
 
         template<class... Args>
@@ -89,7 +118,7 @@ namespace rhost {
 
         inline blobs::blob_id create_blob(const blobs::blob& blob) {
             auto copy = blob;
-            return create_blob(copy);
+            return create_blob(std::move(copy));
         }
 
         blobs::blob_id create_compressed_blob(blobs::blob&& blob);
@@ -105,5 +134,8 @@ namespace rhost {
         }
 
         void destroy_blob(blobs::blob_id id);
+
+        // Snapshot of host statistics, as returned in response to "?Stats". Can be called from any thread.
+        picojson::value get_stats();
     }
 }
@@ -0,0 +1,116 @@
+/* ****************************************************************************
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved. 
+ *
+ *
+ * This file is part of Microsoft R Host.
+ * 
+ * Microsoft R Host is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Microsoft R Host is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***************************************************************************/
+
+
+#include "eval.h"
+
+// Kept apart from the rest of eval.cpp, so that test/interrupt_bench.cpp can link it without R.
+
+namespace rhost {
+    namespace eval {
+        namespace {
+            interrupt_delivery delivery = interrupt_delivery::callback;
+
+            // Set while an interrupt is requested; interrupt_delivered is set once R_interrupts_pending has been set
+            // on behalf of that request. Rf_onintr clears R_interrupts_pending, so if it's cleared while the request
+            // is delivered, R has acted on it.
+            std::atomic<bool> interrupt_requested(false), interrupt_delivered(false);
+
+            // If R_interrupts_pending is already set, R is going to act on that regardless, and it's not ours to clear.
+            void deliver_interrupt() {
+                if (interrupt_requested.load(std::memory_order_acquire) && !R_interrupts_pending) {
+                    R_interrupts_pending = 1;
+                    interrupt_delivered.store(true, std::memory_order_release);
+                }
+            }
+
+#ifndef _WIN32
+            // Not otherwise used by R, and ignored by default, so a stray one is harmless.
+            const int interrupt_signal = SIGURG;
+            pthread_t r_thread;
+
+            void interrupt_signal_handler(int) {
+                deliver_interrupt();
+            }
+#endif
+        }
+
+        void set_interrupt_delivery(interrupt_delivery d) {
+#ifdef _WIN32
+            delivery = d == interrupt_delivery::callback ? d : interrupt_delivery::flag;
+#else
+            delivery = d;
+            if (delivery == interrupt_delivery::signal) {
+                r_thread = pthread_self();
+
+                // SA_RESTART, so that system calls made by R or by packages don't unexpectedly fail with EINTR.
+                struct sigaction sa = {};
+                sa.sa_handler = interrupt_signal_handler;
+                sa.sa_flags = SA_RESTART;
+                sigemptyset(&sa.sa_mask);
+                sigaction(interrupt_signal, &sa, nullptr);
+            }
+#endif
+        }
+
+        void request_interrupt() {
+            if (delivery == interrupt_delivery::callback) {
+                return;
+            }
+
+            interrupt_requested.store(true, std::memory_order_release);
+#ifndef _WIN32
+            if (delivery == interrupt_delivery::signal) {
+                pthread_kill(r_thread, interrupt_signal);
+                return;
+            }
+#endif
+            deliver_interrupt();
+        }
+
+        void retract_interrupt() {
+            if (!interrupt_requested.exchange(false, std::memory_order_acq_rel)) {
+                return;
+            }
+            if (interrupt_delivered.exchange(false, std::memory_order_acq_rel)) {
+                R_interrupts_pending = 0;
+            }
+        }
+
+        bool consume_interrupt() {
+            if (!interrupt_delivered.load(std::memory_order_acquire) || R_interrupts_pending) {
+                return false;
+            }
+            interrupt_requested.store(false, std::memory_order_relaxed);
+            interrupt_delivered.store(false, std::memory_order_relaxed);
+            return true;
+        }
+
+        void interrupt_eval() {
+            // Rf_onintr clears R_interrupts_pending itself.
+            interrupt_requested.store(false, std::memory_order_relaxed);
+            interrupt_delivered.store(false, std::memory_order_relaxed);
+            was_eval_canceled = true;
+            Rf_onintr();
+        }
+    }
+}
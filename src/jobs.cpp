@@ -0,0 +1,400 @@
+/* ****************************************************************************
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved. 
+ *
+ *
+ * This file is part of Microsoft R Host.
+ * 
+ * Microsoft R Host is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Microsoft R Host is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***************************************************************************/
+
+
+#include "stdafx.h"
+#include "jobs.h"
+#include "host.h"
+#include "log.h"
+#include "message.h"
+
+using namespace rhost::log;
+using namespace rhost::protocol;
+
+namespace rhost {
+    namespace jobs {
+        namespace {
+            // Only this much of the most recent output of every job is retained.
+            const size_t output_capacity = 0x100000;
+
+            // Only this many of the most recently finished jobs are retained.
+            const size_t max_finished_jobs = 64;
+
+            const size_t max_running_jobs = std::max(1u, std::thread::hardware_concurrency());
+
+            enum class job_state { queued, running, succeeded, failed, canceled };
+
+            const char* state_name(job_state state) {
+                switch (state) {
+                case job_state::queued:
+                    return "queued";
+                case job_state::running:
+                    return "running";
+                case job_state::succeeded:
+                    return "succeeded";
+                case job_state::failed:
+                    return "failed";
+                case job_state::canceled:
+                    return "canceled";
+                default:
+                    assert(false);
+                    return nullptr;
+                }
+            }
+
+            bool is_finished(job_state state) {
+                return state != job_state::queued && state != job_state::running;
+            }
+
+            struct job {
+                job_id id;
+                std::string name, script;
+                job_state state;
+                std::string error;
+
+                // Retained output, and the offset of its first character in the complete output of the job.
+                std::string output;
+                uint64_t output_start;
+
+                bool is_cancel_requested;
+#ifndef _WIN32
+                // Host process of the job while it's running, or 0 once it has exited, and is about to be reaped.
+                pid_t pid;
+#endif
+            };
+
+            fs::path program;
+            std::vector<std::string> host_args;
+
+            // All jobs that are retained, in the order in which they were submitted.
+            std::map<job_id, std::shared_ptr<job>> jobs;
+            size_t running_count;
+            job_id last_job_id;
+            std::mutex jobs_mutex;
+
+            // Must be called with jobs_mutex held, so that notifications are sent in the same order as the changes.
+            // State changes are sent rather than posted, since a posted notification can be dropped, and the client
+            // would then never learn that the job has finished. Output is still posted; whatever was posted before a
+            // state change is flushed ahead of it.
+            void set_state(job& j, job_state state, const std::string& error = std::string()) {
+                j.state = state;
+                j.error = error;
+
+                picojson::value error_json = error.empty() ? picojson::value() : picojson::value(error);
+                host::send_notification("!JobState", picojson::array{
+                    picojson::value(static_cast<double>(j.id)), picojson::value(state_name(state)), error_json });
+            }
+
+            // Must be called with jobs_mutex held.
+            void discard_old_jobs() {
+                size_t finished_count = std::count_if(jobs.begin(), jobs.end(), [](const auto& kv) {
+                    return is_finished(kv.second->state);
+                });
+
+                for (auto it = jobs.begin(); it != jobs.end() && finished_count > max_finished_jobs;) {
+                    if (is_finished(it->second->state)) {
+                        it = jobs.erase(it);
+                        --finished_count;
+                    } else {
+                        ++it;
+                    }
+                }
+            }
+
+            void append_output(job& j, const std::string& text, bool is_stderr) {
+                std::lock_guard<std::mutex> lock(jobs_mutex);
+
+                uint64_t offset = j.output_start + j.output.size();
+                j.output += text;
+                if (j.output.size() > output_capacity) {
+                    size_t excess = j.output.size() - output_capacity;
+                    j.output.erase(0, excess);
+                    j.output_start += excess;
+                }
+
+                host::post_notification("!JobOutput", picojson::array{
+                    picojson::value(static_cast<double>(j.id)), picojson::value(static_cast<double>(offset)),
+                    picojson::value(text), picojson::value(is_stderr) });
+            }
+
+            void start_queued_jobs();
+
+#ifndef _WIN32
+            bool send_to_job(FILE* input, const message& msg) {
+                auto& payload = msg.payload();
+                boost::endian::little_uint32_buf_t msg_size(static_cast<uint32_t>(payload.size()));
+                return fwrite(&msg_size, sizeof msg_size, 1, input) == 1 && fwrite(payload.data(), payload.size(), 1, input) == 1;
+            }
+
+            bool receive_from_job(FILE* output, message& msg) {
+                boost::endian::little_uint32_buf_t msg_size;
+                if (fread(&msg_size, sizeof msg_size, 1, output) != 1) {
+                    return false;
+                }
+
+                std::string payload(msg_size.value(), '\0');
+                if (!payload.empty() && fread(&payload[0], payload.size(), 1, output) != 1) {
+                    return false;
+                }
+
+                msg = message::parse(std::move(payload));
+                return true;
+            }
+
+            // Acts as the client for the host of the job: once that host is ready to accept evals, submits the script
+            // as an eval, relays any console output from it, and shuts the host down once the eval completes.
+            void run_job(std::shared_ptr<job> j, int input_fd, int output_fd) {
+                // R handles SIGPIPE by raising an R error, which must not happen on this thread if the host of the job
+                // goes away while something is being written to it. With the signal blocked, write just fails instead.
+                sigset_t sigpipe;
+                sigemptyset(&sigpipe);
+                sigaddset(&sigpipe, SIGPIPE);
+                pthread_sigmask(SIG_BLOCK, &sigpipe, nullptr);
+
+                FILE* input = fdopen(input_fd, "wb");
+                setvbuf(input, NULL, _IONBF, 0);
+                FILE* output = fdopen(output_fd, "rb");
+
+                message_id eval_id = 0;
+                bool has_result = false;
+                std::string error;
+
+                for (message msg; receive_from_job(output, msg);) {
+                    std::string name = msg.name();
+                    if (msg.is_request() && name == "?>") {
+                        // The first prompt means that the host is ready. Since the eval doesn't allow callbacks, there
+                        // won't be any more prompts, so the request is left unanswered.
+                        if (!eval_id) {
+                            // Braces make the script stop at the first error, as Rscript would.
+                            message eval(message::request_marker, "?=0", picojson::array{ picojson::value("{\n" + j->script + "\n}") }, blobs::blob());
+                            eval_id = eval.id();
+                            send_to_job(input, eval);
+                        }
+                    } else if (msg.is_notification() && (name == "!" || name == "!!")) {
+                        // Anything printed before the script started running (e.g. the R banner) is not part of the output.
+                        auto args = msg.json();
+                        if (eval_id && args.size() == 1 && args[0].is<std::string>()) {
+                            append_output(*j, args[0].get<std::string>(), name == "!!");
+                        }
+                    } else if (eval_id && msg.request_id() == eval_id) {
+                        // [parse_status, error] if evaluated, or [null] if canceled.
+                        has_result = true;
+                        auto args = msg.json();
+                        if (args.size() > 1 && args[1].is<std::string>()) {
+                            error = args[1].get<std::string>();
+                        } else if (args.empty() || !args[0].is<std::string>()) {
+                            error = "Script evaluation was canceled.";
+                        } else if (args[0].get<std::string>() != "OK") {
+                            error = "Couldn't parse script: " + args[0].get<std::string>();
+                        }
+
+                        message shutdown(0, "!Shutdown", picojson::array{ picojson::value(false) }, blobs::blob());
+                        send_to_job(input, shutdown);
+                    }
+                }
+
+                fclose(input);
+                fclose(output);
+
+                pid_t pid;
+                {
+                    std::lock_guard<std::mutex> lock(jobs_mutex);
+                    pid = j->pid;
+                    j->pid = 0;
+                }
+
+                int status = 0;
+                while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+                }
+
+                std::lock_guard<std::mutex> lock(jobs_mutex);
+                --running_count;
+                if (has_result) {
+                    set_state(*j, error.empty() ? job_state::succeeded : job_state::failed, error);
+                } else if (j->is_cancel_requested) {
+                    set_state(*j, job_state::canceled);
+                } else {
+                    set_state(*j, job_state::failed, "Job host terminated unexpectedly (status " + std::to_string(status) + ").");
+                }
+
+                discard_old_jobs();
+                start_queued_jobs();
+            }
+
+            // Must be called with jobs_mutex held.
+            void start_job(std::shared_ptr<job> j) {
+                std::vector<std::string> args;
+                args.push_back(program.string());
+                args.insert(args.end(), host_args.begin(), host_args.end());
+                args.push_back("--rhost-name");
+                args.push_back("job" + std::to_string(j->id));
+
+                std::vector<char*> argv;
+                for (auto& arg : args) {
+                    argv.push_back(&arg[0]);
+                }
+                argv.push_back(nullptr);
+
+                // Pipes are close-on-exec, so that no other child process (including the hosts of other jobs) holds on
+                // to them; dup2 in the child clears the flag on the copies that become its stdin and stdout. The flag
+                // is set atomically, since another thread may be forking at the same time.
+                int input_fds[2], output_fds[2];
+                if (pipe2(input_fds, O_CLOEXEC) != 0) {
+                    set_state(*j, job_state::failed, std::string("Couldn't create pipe for job host: ") + strerror(errno));
+                    return;
+                }
+                if (pipe2(output_fds, O_CLOEXEC) != 0) {
+                    set_state(*j, job_state::failed, std::string("Couldn't create pipe for job host: ") + strerror(errno));
+                    close(input_fds[0]);
+                    close(input_fds[1]);
+                    return;
+                }
+
+                pid_t pid = fork();
+                if (pid == 0) {
+                    // Only async-signal-safe functions can be used here, since other threads of the parent might have
+                    // been holding locks at the moment of the fork.
+                    dup2(input_fds[0], STDIN_FILENO);
+                    dup2(output_fds[1], STDOUT_FILENO);
+                    execv(argv[0], argv.data());
+                    _exit(127);
+                }
+
+                int fork_error = errno;
+                close(input_fds[0]);
+                close(output_fds[1]);
+                if (pid < 0) {
+                    close(input_fds[1]);
+                    close(output_fds[0]);
+                    set_state(*j, job_state::failed, std::string("Couldn't start job host: ") + strerror(fork_error));
+                    return;
+                }
+
+                logf(log_verbosity::normal, "Job %llu is running in process %d.\n", j->id, pid);
+                j->pid = pid;
+                ++running_count;
+                set_state(*j, job_state::running);
+                std::thread(run_job, j, input_fds[1], output_fds[0]).detach();
+            }
+#else
+            // Job hosts are not started on Windows, so every job fails as soon as it would start; see submit.
+            void start_job(std::shared_ptr<job> j) {
+                set_state(*j, job_state::failed, "Jobs are not supported on Windows.");
+            }
+#endif
+
+            // Must be called with jobs_mutex held.
+            void start_queued_jobs() {
+                for (auto it = jobs.begin(); it != jobs.end() && running_count < max_running_jobs; ++it) {
+                    if (it->second->state == job_state::queued) {
+                        start_job(it->second);
+                    }
+                }
+            }
+        }
+
+        void initialize(const fs::path& program, const std::vector<std::string>& host_args) {
+            jobs::program = program;
+            jobs::host_args = host_args;
+        }
+
+        job_id submit(const std::string& name, const std::string& script) {
+            std::lock_guard<std::mutex> lock(jobs_mutex);
+
+            auto j = std::make_shared<job>();
+            j->id = ++last_job_id;
+            j->name = name;
+            j->script = script;
+            j->output_start = 0;
+            j->is_cancel_requested = false;
+#ifndef _WIN32
+            j->pid = 0;
+#endif
+            jobs[j->id] = j;
+
+            logf(log_verbosity::normal, "Job %llu submitted: %s\n", j->id, name.c_str());
+            set_state(*j, job_state::queued);
+            start_queued_jobs();
+            return j->id;
+        }
+
+        picojson::array list() {
+            std::lock_guard<std::mutex> lock(jobs_mutex);
+
+            picojson::array result;
+            for (const auto& kv : jobs) {
+                const auto& j = *kv.second;
+                picojson::object obj;
+                obj["id"] = picojson::value(static_cast<double>(j.id));
+                obj["name"] = picojson::value(j.name);
+                obj["state"] = picojson::value(state_name(j.state));
+                obj["error"] = j.error.empty() ? picojson::value() : picojson::value(j.error);
+                obj["output_size"] = picojson::value(static_cast<double>(j.output_start + j.output.size()));
+                result.push_back(picojson::value(std::move(obj)));
+            }
+            return result;
+        }
+
+        bool cancel(job_id id) {
+            std::lock_guard<std::mutex> lock(jobs_mutex);
+
+            auto it = jobs.find(id);
+            if (it == jobs.end()) {
+                return false;
+            }
+
+            auto& j = *it->second;
+            if (j.state == job_state::queued) {
+                set_state(j, job_state::canceled);
+                discard_old_jobs();
+                return true;
+            } else if (j.state != job_state::running) {
+                return false;
+            }
+
+            if (!j.is_cancel_requested) {
+                j.is_cancel_requested = true;
+#ifndef _WIN32
+                if (j.pid) {
+                    kill(j.pid, SIGKILL);
+                }
+#endif
+            }
+            return true;
+        }
+
+        bool get_output(job_id id, uint64_t offset, std::string& text, uint64_t& end_offset) {
+            std::lock_guard<std::mutex> lock(jobs_mutex);
+
+            auto it = jobs.find(id);
+            if (it == jobs.end()) {
+                return false;
+            }
+
+            const auto& j = *it->second;
+            end_offset = j.output_start + j.output.size();
+            uint64_t start = std::max(offset, j.output_start);
+            text = start < end_offset ? j.output.substr(static_cast<size_t>(start - j.output_start)) : std::string();
+            return true;
+        }
+    }
+}
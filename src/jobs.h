@@ -0,0 +1,63 @@
+/* ****************************************************************************
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved. 
+ *
+ *
+ * This file is part of Microsoft R Host.
+ * 
+ * Microsoft R Host is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Microsoft R Host is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***************************************************************************/
+
+
+#pragma once
+#include "stdafx.h"
+
+namespace rhost {
+    namespace jobs {
+        typedef uint64_t job_id; // range of values constrained to always fit a double
+
+        // Must be called before any jobs are submitted. program is the host executable, and host_args are the
+        // command line arguments (other than argv[0]) to start a child host for a job with; each job gets its
+        // own "--rhost-name" appended to them.
+        void initialize(const fs::path& program, const std::vector<std::string>& host_args);
+
+        // Queues script to be run as a job, and returns its ID. Each job runs in a separate child host process,
+        // which is started once fewer than one job per core is running, and shut down once the script completes.
+        // The script is evaluated as a single eval in the global environment of the child, with callbacks disabled.
+        //
+        // Changes in the state of the job are reported with "!JobState [id, state, error]" notifications, where
+        // state is one of "queued", "running", "succeeded", "failed" or "canceled", and error is null unless the
+        // job has failed. Console output of the job is reported with "!JobOutput [id, offset, text, is_stderr]"
+        // notifications as it's produced, where offset is the position of text in the output of the job.
+        //
+        // Not supported on Windows: the job is still queued, but moves to "failed" with an error saying so instead
+        // of running.
+        job_id submit(const std::string& name, const std::string& script);
+
+        // Returns [{"id": ..., "name": ..., "state": ..., "error": ..., "output_size": ...}, ...] for all jobs
+        // that are queued, running, or are among the most recently finished ones. Older finished jobs, and their
+        // output, are discarded.
+        picojson::array list();
+
+        // Cancels a queued or running job, killing its host process if it's already running. Returns false if
+        // there's no such job, or it has already finished.
+        bool cancel(job_id id);
+
+        // Retrieves the output of the job from the specified offset onward, and the offset that the output ends
+        // at. Only the most recent part of the output of each job is retained, so text can start past offset.
+        // Returns false if there's no such job.
+        bool get_output(job_id id, uint64_t offset, std::string& text, uint64_t& end_offset);
+    }
+}
@@ -25,18 +25,35 @@
 #include "r_api.h"
 #include "log.h"
 
-#define RHOST_RAPI_DEFINE(api) decltype(api) *RHOST_RAPI_PTR(api)
-#define RHOST_RAPI_DEFINE_NULLPTR(api) RHOST_RAPI_DEFINE(api) = nullptr;
+#define RHOST_RAPI_DEFINE(api) rapi_slot<decltype(api)*>::type RHOST_RAPI_PTR(api)
+#define RHOST_RAPI_DEFINE_NULLPTR(api) RHOST_RAPI_DEFINE(api) {};
+#define RHOST_RAPI_OPTIONAL_DEFINE_NULLPTR(api) decltype(api) *RHOST_RAPI_PTR(api) = nullptr;
 
 #define RHOST_GD_DEFINE(api) \
     decltype(gd_api<10>::api) gd_api<10>::api; \
     decltype(gd_api<12>::api) gd_api<12>::api;
 
 #define RHOST_GET_PROC(m, api) RHOST_RAPI_PTR(api) = get_proc<decltype(api)*>(m, RHOST_RAPI_STR(api));
-#define RHOST_RAPI_GET_PROC(api) RHOST_GET_PROC(r_module, api)
+
+#define RHOST_RAPI_OPTIONAL_GET_PROC(api) \
+    RHOST_GET_PROC(r_module, api) \
+    if (!RHOST_RAPI_PTR(api)) { \
+        log::logf(log::log_verbosity::minimal, "Optional R API function %s not found; using fallback.\n", RHOST_RAPI_STR(api)); \
+    }
 #define RHOST_RAPI_UNLOAD(api) RHOST_RAPI_PTR(api) = nullptr;
 
-#define RHOST_GD_GET_PROC(api) api = get_proc<decltype(api)>(r_module, RHOST_RAPI_STR(api));
+// The local class identifies the pointer variable and the symbol name for the thunk; see lazy_proc.
+#define RHOST_LAZY_GET_PROC(ptr, api) { \
+        struct lazy_tag { \
+            static decltype(ptr)& slot() { return ptr; } \
+            static const char* name() { return RHOST_RAPI_STR(api); } \
+        }; \
+        ptr = lazy_proc<decltype(ptr), lazy_tag>::get(r_module, RHOST_RAPI_STR(api)); \
+    }
+
+#define RHOST_RAPI_GET_PROC(api) RHOST_LAZY_GET_PROC(RHOST_RAPI_PTR(api), api)
+
+#define RHOST_GD_GET_PROC(api) RHOST_LAZY_GET_PROC(api, api)
 #define RHOST_GD_UNLOAD(api) api = nullptr;
 
 #ifdef _WIN32
@@ -52,6 +69,7 @@ typedef void* rhost_module_t;
 namespace rhost {
     namespace rapi {
         RHOST_RAPI_SET(RHOST_RAPI_DEFINE_NULLPTR);
+        RHOST_RAPI_SET_OPTIONAL(RHOST_RAPI_OPTIONAL_DEFINE_NULLPTR);
         RHOST_GD_SET(RHOST_GD_DEFINE);
 #ifdef _WIN32
         RHOST_RGRAPHAPPAPI_SET(RHOST_RAPI_DEFINE_NULLPTR);
@@ -72,12 +90,47 @@ namespace rhost {
                 return ptr;
             }
 
+            // Most APIs are only used in some rare scenarios, if at all, so rather than looking up all of them when R is
+            // loaded, function pointers initially point to a thunk that looks up the actual function on first call, stores
+            // the pointer to it in place of the thunk, and forwards the call. This is only possible for functions with a
+            // fixed number of arguments; data symbols and variadic functions are looked up immediately.
+            //
+            // If two threads call the same function for the first time concurrently, they both look it up, and store the
+            // same value into the atomic_proc. Symbols that are not found only result in an error if they're actually
+            // used, so anything that is not present in all supported versions of R belongs in RHOST_RAPI_SET_OPTIONAL.
+            template<class Slot, class Tag>
+            struct lazy_proc {
+                static Slot get(rhost_module_t module, const char* name) {
+                    return get_proc<Slot>(module, name);
+                }
+            };
+
+            template<class R, class... Args, class Tag>
+            struct lazy_proc<atomic_proc<R(Args...)>, Tag> {
+                typedef R(*ptr_type)(Args...);
+
+                static R thunk(Args... args) {
+                    ptr_type ptr = get_proc<ptr_type>(r_module, Tag::name());
+                    if (!ptr) {
+                        log::fatal_error("R API function %s not found", Tag::name());
+                    }
+                    Tag::slot() = ptr;
+                    return ptr(std::forward<Args>(args)...);
+                }
+
+                static ptr_type get(rhost_module_t, const char*) {
+                    return &thunk;
+                }
+            };
+
             void internal_load_r_apis() {
                 RHOST_RAPI_SET(RHOST_RAPI_GET_PROC);
+                RHOST_RAPI_SET_OPTIONAL(RHOST_RAPI_OPTIONAL_GET_PROC);
             }
 
             void internal_unload_r_apis() {
                 RHOST_RAPI_SET(RHOST_RAPI_UNLOAD);
+                RHOST_RAPI_SET_OPTIONAL(RHOST_RAPI_UNLOAD);
             }
 
 #ifdef _WIN32
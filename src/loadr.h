@@ -23,34 +23,96 @@
 #pragma once
 #include "stdafx.h"
 
+namespace rhost {
+    namespace rapi {
+        // Pointer to an R API function. It initially points to a thunk that looks up the actual function on first call
+        // and stores the pointer to it in place of itself (see lazy_proc in loadr.cpp), which can happen on several
+        // threads at once; hence atomic. Nothing else is published through it, so relaxed ordering is sufficient.
+        template<class F>
+        class atomic_proc;
+
+        template<class R, class... Args>
+        class atomic_proc<R(Args...)> {
+        public:
+            typedef R(*pointer)(Args...);
+
+            constexpr atomic_proc() : ptr(nullptr) {
+            }
+
+            atomic_proc& operator= (pointer p) {
+                ptr.store(p, std::memory_order_relaxed);
+                return *this;
+            }
+
+            operator pointer() const {
+                return ptr.load(std::memory_order_relaxed);
+            }
+
+            R operator() (Args... args) const {
+                return static_cast<pointer>(*this)(std::forward<Args>(args)...);
+            }
+
+        private:
+            std::atomic<pointer> ptr;
+        };
+
+        // Type of the variable holding a pointer of type Ptr to an R API symbol. Functions with a fixed number of
+        // arguments are bound lazily, and need an atomic_proc; everything else is looked up when R is loaded.
+        template<class Ptr>
+        struct rapi_slot {
+            typedef Ptr type;
+        };
+
+        template<class R, class... Args>
+        struct rapi_slot<R(*)(Args...)> {
+            typedef atomic_proc<R(Args...)> type;
+        };
+    }
+}
+
 #define RHOST_RAPI_PTR(api) fp_##api
-#define RHOST_RAPI_DECL(api) extern decltype(api) *RHOST_RAPI_PTR(api)
+#define RHOST_RAPI_DECL(api) extern rapi_slot<decltype(api)*>::type RHOST_RAPI_PTR(api)
 #define RHOST_RAPI_DECL_END(api) RHOST_RAPI_DECL(api);
+#define RHOST_RAPI_OPTIONAL_DECL_END(api) extern decltype(api) *RHOST_RAPI_PTR(api);
 #define RHOST_RAPI_STR(api) #api
 #define RAPI(api) rhost::rapi::RHOST_RAPI_PTR(api)
 
 #define RHOST_RAPI_SET_COMMON(macro) \
+macro(ATTRIB) \
 macro(CAR) \
 macro(CDR) \
+macro(ENCLOS) \
+macro(FORMALS) \
+macro(FRAME) \
+macro(HASHTAB) \
 macro(INTEGER) \
 macro(LOGICAL) \
 macro(PRCODE) \
+macro(PRINTNAME) \
 macro(PRVALUE) \
 macro(R_BaseEnv) \
+macro(R_BindingIsActive) \
 macro(R_CHAR) \
+macro(R_ClassSymbol) \
 macro(R_CleanUp) \
 macro(R_common_command_line) \
 macro(R_curErrorBuf) \
 macro(R_DefParams) \
+macro(R_DimNamesSymbol) \
+macro(R_DimSymbol) \
 macro(R_EmptyEnv) \
 macro(R_FunTab) \
+macro(R_gc) \
 macro(R_getEmbeddingDllInfo) \
 macro(R_GlobalContext) \
 macro(R_GlobalEnv) \
 macro(R_IsNA) \
+macro(R_LevelsSymbol) \
 macro(R_lsInternal3) \
+macro(R_MakeExternalPtr) \
 macro(R_NaInt) \
 macro(R_NamesSymbol) \
+macro(R_NamespaceRegistry) \
 macro(R_NaString) \
 macro(R_new_custom_connection) \
 macro(R_NilValue) \
@@ -59,7 +121,10 @@ macro(R_PreserveObject) \
 macro(R_ProcessEvents) \
 macro(R_registerRoutines) \
 macro(R_ReleaseObject) \
+macro(R_RegisterCFinalizerEx) \
 macro(R_RestoreGlobalEnvFromFile) \
+macro(R_RowNamesSymbol) \
+macro(R_RunPendingFinalizers) \
 macro(R_running_as_main_program) \
 macro(R_SaveGlobalEnvToFile) \
 macro(R_set_command_line_arguments) \
@@ -78,17 +143,21 @@ macro(Rf_asInteger) \
 macro(Rf_asLogical) \
 macro(Rf_asReal) \
 macro(Rf_classgets) \
+macro(Rf_defineVar) \
 macro(Rf_deparse1line) \
 macro(Rf_duplicate) \
 macro(Rf_error) \
 macro(Rf_eval) \
 macro(Rf_findVar) \
+macro(Rf_findVarInFrame) \
 macro(Rf_getAttrib) \
 macro(Rf_install) \
 macro(Rf_installChar) \
 macro(Rf_isEnvironment) \
 macro(Rf_isNull) \
 macro(Rf_isString) \
+macro(Rf_lang2) \
+macro(Rf_lang3) \
 macro(Rf_length) \
 macro(Rf_mkChar) \
 macro(Rf_mkCharCE) \
@@ -99,14 +168,19 @@ macro(Rf_ScalarInteger) \
 macro(Rf_ScalarLogical) \
 macro(Rf_ScalarReal) \
 macro(Rf_ScalarString) \
+macro(Rf_setAttrib) \
 macro(Rf_translateCharUTF8) \
+macro(Rf_type2char) \
 macro(Rf_unprotect) \
+macro(Rf_xlength) \
+macro(SET_NAMED) \
 macro(SET_RDEBUG) \
 macro(SET_STRING_ELT) \
 macro(SET_TYPEOF) \
 macro(SET_VECTOR_ELT) \
 macro(SETCAR) \
 macro(STRING_ELT) \
+macro(TAG) \
 macro(TYPEOF) \
 macro(VECTOR_ELT) \
 macro(vmaxget) \
@@ -122,6 +196,13 @@ macro(GEcopyDisplayList) \
 macro(run_Rmainloop) \
 macro(setup_Rmainloop)
 
+// APIs that are not present in all supported versions of R. Unlike the others, these are looked up when R is loaded,
+// and are nullptr if not found - so code that uses them must check for that first, and provide a fallback.
+#define RHOST_RAPI_SET_OPTIONAL(macro) \
+macro(INTEGER_GET_REGION) \
+macro(LOGICAL_GET_REGION) \
+macro(REAL_GET_REGION)
+
 #define RHOST_GD_SET(macro) \
 macro(Rf_desc2GEDesc) \
 macro(GEplayDisplayList) \
@@ -165,6 +246,8 @@ macro(ptr_R_WriteConsoleEx) \
 macro(R_Consolefile) \
 macro(R_Interactive) \
 macro(R_Outputfile) \
+macro(R_PolledEvents) \
+macro(R_TempDir) \
 macro(Rf_initialize_R)
 
 #define RHOST_RAPI_SET(macro) \
@@ -178,6 +261,7 @@ namespace rhost {
 
         // R.dll/R.so APIs
         RHOST_RAPI_SET(RHOST_RAPI_DECL_END);
+        RHOST_RAPI_SET_OPTIONAL(RHOST_RAPI_OPTIONAL_DECL_END);
 
 #ifdef _WIN32
         // Rgraphapp.dll/Rgraphapp.so APIs
@@ -189,6 +273,7 @@ namespace rhost {
 }
 
 #ifndef RHOST_NO_API_REDIRECT
+#define ATTRIB rhost::rapi::RHOST_RAPI_PTR(ATTRIB)
 #define CAR rhost::rapi::RHOST_RAPI_PTR(CAR)
 #define CDR rhost::rapi::RHOST_RAPI_PTR(CDR)
 //#define GEaddDevice2 rhost::rapi::RHOST_RAPI_PTR(GEaddDevice2)
@@ -200,19 +285,31 @@ namespace rhost {
 //#define GEkillDevice rhost::rapi::RHOST_RAPI_PTR(GEkillDevice)
 //#define GEplayDisplayList rhost::rapi::RHOST_RAPI_PTR(GEplayDisplayList)
 //#define GEplaySnapshot rhost::rapi::RHOST_RAPI_PTR(GEplaySnapshot)
+#define ENCLOS rhost::rapi::RHOST_RAPI_PTR(ENCLOS)
+#define FORMALS rhost::rapi::RHOST_RAPI_PTR(FORMALS)
+#define FRAME rhost::rapi::RHOST_RAPI_PTR(FRAME)
+#define HASHTAB rhost::rapi::RHOST_RAPI_PTR(HASHTAB)
 #define INTEGER rhost::rapi::RHOST_RAPI_PTR(INTEGER)
+#define INTEGER_GET_REGION rhost::rapi::RHOST_RAPI_PTR(INTEGER_GET_REGION)
 #define LOGICAL rhost::rapi::RHOST_RAPI_PTR(LOGICAL)
+#define LOGICAL_GET_REGION rhost::rapi::RHOST_RAPI_PTR(LOGICAL_GET_REGION)
 #define PRCODE rhost::rapi::RHOST_RAPI_PTR(PRCODE)
+#define PRINTNAME rhost::rapi::RHOST_RAPI_PTR(PRINTNAME)
 #define PRVALUE rhost::rapi::RHOST_RAPI_PTR(PRVALUE)
 #define R_BaseEnv (*rhost::rapi::RHOST_RAPI_PTR(R_BaseEnv))
+#define R_BindingIsActive rhost::rapi::RHOST_RAPI_PTR(R_BindingIsActive)
 #define R_CHAR rhost::rapi::RHOST_RAPI_PTR(R_CHAR)
+#define R_ClassSymbol (*rhost::rapi::RHOST_RAPI_PTR(R_ClassSymbol))
 #define R_CheckDeviceAvailable rhost::rapi::RHOST_RAPI_PTR(R_CheckDeviceAvailable)
 #define R_CleanUp rhost::rapi::RHOST_RAPI_PTR(R_CleanUp)
 #define R_common_command_line rhost::rapi::RHOST_RAPI_PTR(R_common_command_line)
 #define R_curErrorBuf rhost::rapi::RHOST_RAPI_PTR(R_curErrorBuf)
 #define R_DefParams rhost::rapi::RHOST_RAPI_PTR(R_DefParams)
+#define R_DimNamesSymbol (*rhost::rapi::RHOST_RAPI_PTR(R_DimNamesSymbol))
+#define R_DimSymbol (*rhost::rapi::RHOST_RAPI_PTR(R_DimSymbol))
 #define R_EmptyEnv (*rhost::rapi::RHOST_RAPI_PTR(R_EmptyEnv))
 #define R_FunTab (*rhost::rapi::RHOST_RAPI_PTR(R_FunTab))
+#define R_gc rhost::rapi::RHOST_RAPI_PTR(R_gc)
 #define R_GE_getVersion rhost::rapi::RHOST_RAPI_PTR(R_GE_getVersion)
 #define R_getEmbeddingDllInfo rhost::rapi::RHOST_RAPI_PTR(R_getEmbeddingDllInfo)
 #define R_GlobalContext rhost::rapi::RHOST_RAPI_PTR(R_GlobalContext)
@@ -220,9 +317,12 @@ namespace rhost {
 #define R_interrupts_pending (*rhost::rapi::RHOST_RAPI_PTR(R_interrupts_pending))
 #define R_interrupts_suspended (*rhost::rapi::RHOST_RAPI_PTR(R_interrupts_suspended))
 #define R_IsNA rhost::rapi::RHOST_RAPI_PTR(R_IsNA)
+#define R_LevelsSymbol (*rhost::rapi::RHOST_RAPI_PTR(R_LevelsSymbol))
 #define R_lsInternal3 rhost::rapi::RHOST_RAPI_PTR(R_lsInternal3)
+#define R_MakeExternalPtr rhost::rapi::RHOST_RAPI_PTR(R_MakeExternalPtr)
 #define R_NaInt (*rhost::rapi::RHOST_RAPI_PTR(R_NaInt))
 #define R_NamesSymbol (*rhost::rapi::RHOST_RAPI_PTR(R_NamesSymbol))
+#define R_NamespaceRegistry (*rhost::rapi::RHOST_RAPI_PTR(R_NamespaceRegistry))
 #define R_NaString (*rhost::rapi::RHOST_RAPI_PTR(R_NaString))
 #define R_new_custom_connection rhost::rapi::RHOST_RAPI_PTR(R_new_custom_connection)
 #define R_NilValue (*rhost::rapi::RHOST_RAPI_PTR(R_NilValue))
@@ -231,7 +331,10 @@ namespace rhost {
 #define R_ProcessEvents rhost::rapi::RHOST_RAPI_PTR(R_ProcessEvents)
 #define R_registerRoutines rhost::rapi::RHOST_RAPI_PTR(R_registerRoutines)
 #define R_ReleaseObject rhost::rapi::RHOST_RAPI_PTR(R_ReleaseObject)
+#define R_RegisterCFinalizerEx rhost::rapi::RHOST_RAPI_PTR(R_RegisterCFinalizerEx)
 #define R_RestoreGlobalEnvFromFile rhost::rapi::RHOST_RAPI_PTR(R_RestoreGlobalEnvFromFile)
+#define R_RowNamesSymbol (*rhost::rapi::RHOST_RAPI_PTR(R_RowNamesSymbol))
+#define R_RunPendingFinalizers rhost::rapi::RHOST_RAPI_PTR(R_RunPendingFinalizers)
 #define R_running_as_main_program (*rhost::rapi::RHOST_RAPI_PTR(R_running_as_main_program))
 #define R_SaveGlobalEnvToFile rhost::rapi::RHOST_RAPI_PTR(R_SaveGlobalEnvToFile)
 #define R_set_command_line_arguments rhost::rapi::RHOST_RAPI_PTR(R_set_command_line_arguments)
@@ -242,6 +345,7 @@ namespace rhost {
 #define RAW rhost::rapi::RHOST_RAPI_PTR(RAW)
 #define RDEBUG rhost::rapi::RHOST_RAPI_PTR(RDEBUG)
 #define REAL rhost::rapi::RHOST_RAPI_PTR(REAL)
+#define REAL_GET_REGION rhost::rapi::RHOST_RAPI_PTR(REAL_GET_REGION)
 #define Rf_allocList rhost::rapi::RHOST_RAPI_PTR(Rf_allocList)
 #define Rf_allocVector rhost::rapi::RHOST_RAPI_PTR(Rf_allocVector)
 #define Rf_allocVector3 rhost::rapi::RHOST_RAPI_PTR(Rf_allocVector3)
@@ -251,18 +355,22 @@ namespace rhost {
 #define Rf_asReal rhost::rapi::RHOST_RAPI_PTR(Rf_asReal)
 #define Rf_classgets rhost::rapi::RHOST_RAPI_PTR(Rf_classgets)
 #define Rf_curDevice rhost::rapi::RHOST_RAPI_PTR(Rf_curDevice)
+#define Rf_defineVar rhost::rapi::RHOST_RAPI_PTR(Rf_defineVar)
 #define Rf_deparse1line rhost::rapi::RHOST_RAPI_PTR(Rf_deparse1line)
 //#define Rf_desc2GEDesc rhost::rapi::RHOST_RAPI_PTR(Rf_desc2GEDesc)
 #define Rf_duplicate rhost::rapi::RHOST_RAPI_PTR(Rf_duplicate)
 #define Rf_error rhost::rapi::RHOST_RAPI_PTR(Rf_error)
 #define Rf_eval rhost::rapi::RHOST_RAPI_PTR(Rf_eval)
 #define Rf_findVar rhost::rapi::RHOST_RAPI_PTR(Rf_findVar)
+#define Rf_findVarInFrame rhost::rapi::RHOST_RAPI_PTR(Rf_findVarInFrame)
 #define Rf_getAttrib rhost::rapi::RHOST_RAPI_PTR(Rf_getAttrib)
 #define Rf_install rhost::rapi::RHOST_RAPI_PTR(Rf_install)
 #define Rf_installChar rhost::rapi::RHOST_RAPI_PTR(Rf_installChar)
 #define Rf_isEnvironment rhost::rapi::RHOST_RAPI_PTR(Rf_isEnvironment)
 #define Rf_isNull rhost::rapi::RHOST_RAPI_PTR(Rf_isNull)
 #define Rf_isString rhost::rapi::RHOST_RAPI_PTR(Rf_isString)
+#define Rf_lang2 rhost::rapi::RHOST_RAPI_PTR(Rf_lang2)
+#define Rf_lang3 rhost::rapi::RHOST_RAPI_PTR(Rf_lang3)
 #define Rf_length rhost::rapi::RHOST_RAPI_PTR(Rf_length)
 #define Rf_mkChar rhost::rapi::RHOST_RAPI_PTR(Rf_mkChar)
 #define Rf_mkCharCE rhost::rapi::RHOST_RAPI_PTR(Rf_mkCharCE)
@@ -275,10 +383,14 @@ namespace rhost {
 #define Rf_ScalarLogical rhost::rapi::RHOST_RAPI_PTR(Rf_ScalarLogical)
 #define Rf_ScalarReal rhost::rapi::RHOST_RAPI_PTR(Rf_ScalarReal)
 #define Rf_ScalarString rhost::rapi::RHOST_RAPI_PTR(Rf_ScalarString)
+#define Rf_setAttrib rhost::rapi::RHOST_RAPI_PTR(Rf_setAttrib)
 #define Rf_selectDevice rhost::rapi::RHOST_RAPI_PTR(Rf_selectDevice)
 #define Rf_translateCharUTF8 rhost::rapi::RHOST_RAPI_PTR(Rf_translateCharUTF8)
+#define Rf_type2char rhost::rapi::RHOST_RAPI_PTR(Rf_type2char)
 #define Rf_unprotect rhost::rapi::RHOST_RAPI_PTR(Rf_unprotect)
+#define Rf_xlength rhost::rapi::RHOST_RAPI_PTR(Rf_xlength)
 #define run_Rmainloop rhost::rapi::RHOST_RAPI_PTR(run_Rmainloop)
+#define SET_NAMED rhost::rapi::RHOST_RAPI_PTR(SET_NAMED)
 #define SET_RDEBUG rhost::rapi::RHOST_RAPI_PTR(SET_RDEBUG)
 #define SET_STRING_ELT rhost::rapi::RHOST_RAPI_PTR(SET_STRING_ELT)
 #define SET_TYPEOF rhost::rapi::RHOST_RAPI_PTR(SET_TYPEOF)
@@ -286,6 +398,7 @@ namespace rhost {
 #define SETCAR rhost::rapi::RHOST_RAPI_PTR(SETCAR)
 #define setup_Rmainloop rhost::rapi::RHOST_RAPI_PTR(setup_Rmainloop)
 #define STRING_ELT rhost::rapi::RHOST_RAPI_PTR(STRING_ELT)
+#define TAG rhost::rapi::RHOST_RAPI_PTR(TAG)
 #define TYPEOF rhost::rapi::RHOST_RAPI_PTR(TYPEOF)
 #define VECTOR_ELT rhost::rapi::RHOST_RAPI_PTR(VECTOR_ELT)
 #define vmaxget rhost::rapi::RHOST_RAPI_PTR(vmaxget)
@@ -315,6 +428,8 @@ namespace rhost {
 #define R_Consolefile (*rhost::rapi::RHOST_RAPI_PTR(R_Consolefile))
 #define R_Interactive_ (*rhost::rapi::RHOST_RAPI_PTR(R_Interactive))
 #define R_Outputfile (*rhost::rapi::RHOST_RAPI_PTR(R_Outputfile))
+#define R_PolledEvents (*rhost::rapi::RHOST_RAPI_PTR(R_PolledEvents))
+#define R_TempDir (*rhost::rapi::RHOST_RAPI_PTR(R_TempDir))
 #define Rf_initialize_R rhost::rapi::RHOST_RAPI_PTR(Rf_initialize_R)
 
 #endif 
@@ -50,6 +50,8 @@ namespace rhost {
             FILE* logfile;
             int indent;
             log::log_verbosity current_verbosity;
+            bool is_flush_thread_started;
+            bool is_forked_child;
 
             void log_flush_thread() {
                 for (;;) {
@@ -111,7 +113,7 @@ namespace rhost {
         }
 #endif
 
-        void init_log(const std::string& log_suffix, const fs::path& log_dir, log::log_verbosity verbosity, bool suppress_ui) {
+        void init_log(const std::string& log_suffix, const fs::path& log_dir, log::log_verbosity verbosity, bool suppress_ui, bool flush_periodically) {
             {
                 current_verbosity = verbosity;
 
@@ -144,6 +146,11 @@ namespace rhost {
                 fulldump_filename = log_dir / (filename + ".full.dmp");
             }
 
+            // If the log is being re-initialized under a new name, there's nothing left to flush.
+            if (logfile) {
+                fclose(logfile);
+            }
+
 #ifdef _MSC_VER
             logfile = _fsopen(log_filename.make_preferred().string().c_str(), "wc", _SH_DENYWR);
 #else
@@ -154,7 +161,10 @@ namespace rhost {
                 setvbuf(logfile, nullptr, _IOFBF, 0x100000);
 
                 // Start a thread that will flush the buffer periodically.
-                std::thread(log_flush_thread).detach();
+                if (flush_periodically && !is_flush_thread_started) {
+                    is_flush_thread_started = true;
+                    std::thread(log_flush_thread).detach();
+                }
             } else {
                 std::string error = "Error creating logfile: " + log_filename.make_preferred().string() + "\r\n";
                 fprintf(stderr, "Error: %d\r\n", errno);
@@ -173,7 +183,7 @@ namespace rhost {
         }
 
         void vlogf(log_verbosity verbosity, log_level message_type, const char* format, va_list va) {
-            if (verbosity > current_verbosity) {
+            if (verbosity > current_verbosity || is_forked_child) {
                 return;
             }
 
@@ -214,14 +224,29 @@ namespace rhost {
         }
 
         void flush_log() {
+            if (is_forked_child) {
+                return;
+            }
+
             std::lock_guard<std::mutex> lock(log_mutex);
             if (logfile) {
                 fflush(logfile);
             }
         }
 
+#ifndef _WIN32
+        void disable_log_in_forked_child() {
+            // Whatever is in the buffer of logfile belongs to the parent, so it's neither flushed nor closed here.
+            is_forked_child = true;
+        }
+#endif
+
 
         RHOST_NORETURN void terminate(bool unexpected, const char* format, va_list va) {
+            if (is_forked_child) {
+                _exit(unexpected ? EXIT_FAILURE : EXIT_SUCCESS);
+            }
+
             std::lock_guard<std::mutex> terminate_lock(terminate_mutex);
 
             char message[0xFFFF];
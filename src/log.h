@@ -38,7 +38,9 @@ namespace rhost {
             error
         };
 
-        void init_log(const std::string& log_suffix, const fs::path& log_dir, log_verbosity log_level, bool suppress_ui);
+        // If flush_periodically is false, the log is only flushed by explicit calls to flush_log, and no thread is
+        // started. Calling init_log again with it set to true starts the thread, if it hasn't been started already.
+        void init_log(const std::string& log_suffix, const fs::path& log_dir, log_verbosity log_level, bool suppress_ui, bool flush_periodically = true);
 
         void vlogf(log_verbosity level, log_level message_type, const char* format, va_list va);
 
@@ -64,6 +66,13 @@ namespace rhost {
 
         void flush_log();
 
+#ifndef _WIN32
+        // Must be called in a child process forked from a multithreaded host before it does anything else. Another
+        // thread of the parent may have been holding the log lock at the moment of the fork, so all logging in the
+        // child becomes a no-op, and a fatal error there exits the child immediately.
+        void disable_log_in_forked_child();
+#endif
+
         RHOST_NORETURN void terminate(const char* format, ...);
 
         RHOST_NORETURN void fatal_error(const char* format, ...);
@@ -30,7 +30,10 @@
 #include "grdeviceside.h"
 #include "grdevicesxaml.h"
 #include "exports.h"
+#include "zygote.h"
+#include "jobs.h"
 #include "transport.h"
+#include "stats.h"
 
 using namespace rhost::eval;
 using namespace rhost::log;
@@ -47,13 +50,15 @@ namespace rhost {
 #endif
 
     struct command_line_args {
-        fs::path log_dir, rdata, r_dir;
+        fs::path log_dir, rdata, r_dir, zygote;
         std::string name;
         log::log_verbosity log_level;
-        std::chrono::seconds idle_timeout;
+        std::chrono::seconds idle_timeout, checkpoint_interval;
         std::vector<std::string> unrecognized;
         bool suppress_ui;
         bool is_interactive;
+        rhost::eval::interrupt_delivery interrupt_delivery;
+        rhost::memory::thresholds memory_thresholds;
         int argc;
         std::vector<char*> argv;
     };
@@ -76,15 +81,41 @@ namespace rhost {
                 "Shut down the host if it is idle for the specified duration in seconds. "
                 "If " + rdata.long_name() + " was specified, save workspace before exiting."
                 ).c_str()),
+            checkpoint_interval("rhost-checkpoint-interval", po::value<std::chrono::seconds::rep>(), (
+                "Save workspace to the file specified by " + rdata.long_name() + " every specified number of seconds, "
+                "whenever R is idle, without blocking it while the file is being written (POSIX only)."
+                ).c_str()),
             suppress_ui("rhost-suppress-ui", new po::untyped_value(true),
                 "Suppress any UI (e.g., Message Box) from this host instance."),
             is_interactive("rhost-interactive", new po::untyped_value(true),
                 "This R is configured to start in interactive mode."),
             r_dir("rhost-r-dir", po::value<std::string>(), 
-                "Directory to load R.");
+                "Directory to load R."),
+            interrupt_flag("rhost-interrupt-flag", new po::untyped_value(true),
+                "Deliver cancellation requests to R by setting its pending interrupt flag, so that R notices them even in native code "
+                "that doesn't call back into the host. By default, evals are only canceled when R calls back into the host."),
+            interrupt_signal("rhost-interrupt-signal", new po::untyped_value(true), (
+                "Like " + interrupt_flag.long_name() + ", but set the flag by signaling the R thread, so that R also notices "
+                "cancellation requests while waiting in select, poll, or sleep (POSIX only)."
+                ).c_str()),
+            zygote("rhost-zygote", po::value<std::string>(), (
+                "Initialize R, and then fork a new host for every client that connects to the Unix domain socket at the specified path, "
+                "instead of using stdin and stdout (POSIX only). If " + rdata.long_name() + " was specified, the workspace is loaded from it "
+                "before forking, but the forked hosts never save it."
+                ).c_str()),
+            memory_warning("rhost-memory-warning", po::value<double>(),
+                "Notify the client and run a full GC once memory usage reaches the specified percentage of the limit that applies to "
+                "the host - that of its cgroup, if any, or else physical memory (Linux only). Off by default; 80 is a reasonable value."),
+            memory_critical("rhost-memory-critical", po::value<double>(),
+                "Also drop host-side caches, pinned data viewer objects, and snapshots of inactive plots once memory usage reaches "
+                "the specified percentage of the limit (Linux only). Off by default; 90 is a reasonable value."),
+            memory_stall("rhost-memory-stall", po::value<double>(), (
+                "Act as if memory usage reached " + memory_warning.long_name() + " whenever all tasks were stalled on memory "
+                "for the specified percentage of time over the last 10 seconds, as reported by PSI (Linux only). Off by default; 10 is a reasonable value."
+                ).c_str());
 
         po::options_description desc;
-        for (auto&& opt : { help, name, log_level, log_dir, rdata, idle_timeout, suppress_ui, is_interactive, r_dir }) {
+        for (auto&& opt : { help, name, log_level, log_dir, rdata, idle_timeout, checkpoint_interval, suppress_ui, is_interactive, r_dir, interrupt_flag, interrupt_signal, zygote, memory_warning, memory_critical, memory_stall }) {
             boost::shared_ptr<po::option_description> popt(new po::option_description(opt));
             desc.add(popt);
         }
@@ -136,14 +167,44 @@ namespace rhost {
             args.idle_timeout = std::chrono::seconds(n);
         }
 
+        auto checkpoint_interval_arg = vm.find(checkpoint_interval.long_name());
+        if (checkpoint_interval_arg != vm.end()) {
+            auto n = checkpoint_interval_arg->second.as<std::chrono::seconds::rep>();
+            args.checkpoint_interval = std::chrono::seconds(n);
+        }
+
         args.suppress_ui = vm.count(suppress_ui.long_name()) != 0;
         args.is_interactive = vm.count(is_interactive.long_name()) != 0;
+        args.interrupt_delivery =
+            vm.count(interrupt_signal.long_name()) != 0 ? rhost::eval::interrupt_delivery::signal :
+            vm.count(interrupt_flag.long_name()) != 0 ? rhost::eval::interrupt_delivery::flag :
+            rhost::eval::interrupt_delivery::callback;
 
         auto r_dir_arg = vm.find(r_dir.long_name());
         if (r_dir_arg != vm.end()) {
             args.r_dir = r_dir_arg->second.as<std::string>();
         }
 
+        auto zygote_arg = vm.find(zygote.long_name());
+        if (zygote_arg != vm.end()) {
+            args.zygote = zygote_arg->second.as<std::string>();
+        }
+
+        auto memory_warning_arg = vm.find(memory_warning.long_name());
+        if (memory_warning_arg != vm.end()) {
+            args.memory_thresholds.warning = memory_warning_arg->second.as<double>() / 100;
+        }
+
+        auto memory_critical_arg = vm.find(memory_critical.long_name());
+        if (memory_critical_arg != vm.end()) {
+            args.memory_thresholds.critical = memory_critical_arg->second.as<double>() / 100;
+        }
+
+        auto memory_stall_arg = vm.find(memory_stall.long_name());
+        if (memory_stall_arg != vm.end()) {
+            args.memory_thresholds.stall = memory_stall_arg->second.as<double>() / 100;
+        }
+
         args.argv.push_back(argv[0]);
         for (auto& s : args.unrecognized) {
             args.argv.push_back(&s[0]);
@@ -228,7 +289,7 @@ namespace rhost {
         rp.RestoreAction = SA_NORESTORE;
         rp.SaveAction = SA_NOSAVE;
 
-        rhost::host::initialize(rp, args.rdata, args.idle_timeout);
+        rhost::host::initialize(rp, args.rdata, args.idle_timeout, args.checkpoint_interval, args.interrupt_delivery, args.memory_thresholds);
 
         // suppress UI is set only in the remote case, for now can be used to
         // as equivalent of is_remote.
@@ -240,10 +301,12 @@ namespace rhost {
 
         GA_initapp(0, 0);
         readconsolecfg();
+        stats::end_startup_phase("initialize_R");
 
         (*rhost::rapi::RHOST_RAPI_PTR(CharacterMode)) = LinkDLL;
         setup_Rmainloop();
         (*rhost::rapi::RHOST_RAPI_PTR(CharacterMode)) = RGui;
+        stats::end_startup_phase("setup_Rmainloop");
 
         DllInfo *dll = R_getEmbeddingDllInfo();
         rhost::r_util::init(dll);
@@ -252,6 +315,7 @@ namespace rhost {
         rhost::exports::register_all(dll);
 
         set_memory_limit();
+        stats::end_startup_phase("register_exports");
 
         if (!args.rdata.empty()) {
             std::string s = args.rdata.string();
@@ -262,6 +326,7 @@ namespace rhost {
             });
 
             log::logf(log_verbosity::minimal, ok ? "Workspace loaded successfully.\n" : "Failed to load workspace.\n");
+            stats::end_startup_phase("restore_workspace");
         }
 
         UINT_PTR timer = SetTimer(NULL, IDT_RESET_TIMER, 5000, [](HWND hWnd, UINT msg, UINT_PTR idEVent, DWORD dwTime) {
@@ -296,13 +361,20 @@ namespace rhost {
         rp.RestoreAction = SA_NORESTORE;
         rp.SaveAction = SA_NOSAVE;
 
-        rhost::host::initialize(rp, args.rdata, args.idle_timeout);
+        // In zygote mode, there's no client to talk to until after the fork, so R uses its default callbacks
+        // until then; and the host shouldn't start any threads, since they won't survive the fork.
+        bool is_zygote = !args.zygote.empty();
+        if (!is_zygote) {
+            rhost::host::initialize(rp, args.rdata, args.idle_timeout, args.checkpoint_interval, args.interrupt_delivery, args.memory_thresholds);
+        }
 
         R_set_command_line_arguments(args.argc, args.argv.data());
         R_common_command_line(&args.argc, args.argv.data(), &rp);
         R_SetParams(&rp);
-        
+        stats::end_startup_phase("initialize_R");
+
         setup_Rmainloop();
+        stats::end_startup_phase("setup_Rmainloop");
 
         // This is a exported static library member Rf_initialize_R sets it to TRUE
         R_Interactive_ = args.is_interactive ? R_TRUE : R_FALSE;
@@ -315,7 +387,10 @@ namespace rhost {
         rhost::grdevices::ide::init(dll);
         rhost::exports::register_all(dll);
 
-        rhost::host::set_callbacks_posix();
+        if (!is_zygote) {
+            rhost::host::set_callbacks_posix();
+        }
+        stats::end_startup_phase("register_exports");
 
         if (!args.rdata.empty()) {
             std::string s = args.rdata.string();
@@ -326,6 +401,34 @@ namespace rhost {
             });
 
             log::logf(log_verbosity::minimal, ok ? "Workspace loaded successfully.\n" : "Failed to load workspace.\n");
+            stats::end_startup_phase("restore_workspace");
+        }
+
+        if (is_zygote) {
+            // Everything past this point runs in a forked child that serves a single client.
+            auto session = rhost::zygote::serve(args.zygote);
+
+            init_log(session.name.empty() ? args.name : session.name, args.log_dir, args.log_level, args.suppress_ui);
+            stats::end_startup_phase("zygote_wait");
+            transport::initialize(dup(session.fd), session.fd);
+
+            // R created the session temp directory before the fork, and R_CleanUp deletes it when the host exits - from
+            // under the zygote and every other host - so each host needs its own, next to the original.
+            std::string temp_dir = (fs::path(R_TempDir).parent_path() / "RtmpXXXXXX").string();
+            if (!mkdtemp(&temp_dir[0])) {
+                fatal_error("Couldn't create session temp directory %s: %s", temp_dir.c_str(), strerror(errno));
+            }
+            R_TempDir = strdup(temp_dir.c_str());
+            setenv("R_SESSION_TMPDIR", temp_dir.c_str(), 1);
+
+            // Likewise, if anything drew random numbers in the zygote, every host would continue from the same seed.
+            // Without .Random.seed, R seeds the generator from the time and the process ID when it's next used.
+            ParseStatus ps;
+            r_try_eval_str("if (exists('.Random.seed', envir = globalenv(), inherits = FALSE)) rm('.Random.seed', envir = globalenv())",
+                R_GlobalEnv, ps);
+
+            // The workspace was loaded from --rhost-rdata once for all hosts, but they must not all save back to it.
+            rhost::host::initialize(rp, fs::path(), args.idle_timeout, args.checkpoint_interval, args.interrupt_delivery, args.memory_thresholds);
         }
 
         run_Rmainloop();
@@ -336,8 +439,19 @@ namespace rhost {
 
     int run(int argc, char** argv) {
         auto args = rhost::parse_command_line(argc, argv);
-        init_log(args.name, args.log_dir, args.log_level, args.suppress_ui);
-        transport::initialize();
+
+        // The zygote must not have any other threads when it forks, and the log flush thread in particular could be
+        // holding the log lock at that moment - so it only gets one in the forked hosts, once they re-initialize the log.
+        init_log(args.name, args.log_dir, args.log_level, args.suppress_ui, args.zygote.empty());
+        if (args.zygote.empty()) {
+            transport::initialize();
+        }
+#ifdef _WIN32
+        else {
+            logf(log_verbosity::minimal, "--rhost-zygote is not supported on Windows");
+            return 0;
+        }
+#endif
 
         if (args.r_dir.empty()) {
             logf(log_verbosity::minimal, "--rhost-r-dir is a required argument");
@@ -345,7 +459,23 @@ namespace rhost {
         }
         
         add_dir_to_loader_path(args.r_dir);
+
+        // Jobs run in child hosts that use the same R and logging settings as this one, but otherwise start from scratch.
+        boost::system::error_code ec;
+        fs::path program = fs::read_symlink("/proc/self/exe", ec);
+        if (ec) {
+            program = fs::absolute(argv[0]);
+        }
+        rhost::jobs::initialize(program, {
+            "--rhost-r-dir", args.r_dir.string(),
+            "--rhost-log-dir", args.log_dir.string(),
+            "--rhost-log-verbosity", std::to_string(static_cast<int>(args.log_level)),
+            "--rhost-suppress-ui"
+        });
+        stats::end_startup_phase("initialize_host");
+
         rhost::rapi::load_r_apis(args.r_dir);
+        stats::end_startup_phase("load_r_apis");
 
 #ifdef _WIN32
         return rhost::run_r_windows(args);
@@ -0,0 +1,249 @@
+/* ****************************************************************************
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved. 
+ *
+ *
+ * This file is part of Microsoft R Host.
+ * 
+ * Microsoft R Host is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Microsoft R Host is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***************************************************************************/
+
+
+#include "stdafx.h"
+#include "memory.h"
+
+namespace rhost {
+    namespace memory {
+        namespace {
+            std::atomic<pressure_level> current_level(pressure_level::normal);
+        }
+
+        const char* to_string(pressure_level level) {
+            switch (level) {
+            case pressure_level::warning:
+                return "warning";
+            case pressure_level::critical:
+                return "critical";
+            default:
+                return "normal";
+            }
+        }
+
+        picojson::value to_json(const status& st) {
+            auto size = [](int64_t n) {
+                return n >= 0 ? picojson::value(static_cast<double>(n)) : picojson::value();
+            };
+            auto fraction = [](double x) {
+                return x >= 0 ? picojson::value(x) : picojson::value();
+            };
+
+            picojson::object result;
+            result["level"] = picojson::value(to_string(st.level));
+            result["rss"] = size(st.rss);
+            result["rss_peak"] = size(st.rss_peak);
+            result["limit"] = size(st.limit);
+            result["used"] = size(st.used);
+            result["limit_source"] = st.limit < 0 ? picojson::value() : picojson::value(st.is_cgroup_limit ? "cgroup" : "system");
+            result["stall_some"] = fraction(st.stall_some);
+            result["stall_full"] = fraction(st.stall_full);
+            return picojson::value(std::move(result));
+        }
+
+#ifdef _WIN32
+        status get_status() {
+            return status{ current_level.load(), -1, -1, -1, -1, false, -1, -1 };
+        }
+
+        void start_monitor(const thresholds& limits, level_changed_handler level_changed) {
+        }
+#else
+        namespace {
+            const auto poll_interval = std::chrono::seconds(1);
+
+            // How far below a threshold usage must drop before the level that it raised is lowered again.
+            const double hysteresis = 0.05;
+
+            const fs::path cgroup_root = "/sys/fs/cgroup";
+
+            bool read_file(const fs::path& path, std::string& contents) {
+                std::ifstream f(path.string());
+                if (!f) {
+                    return false;
+                }
+                contents.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+                return true;
+            }
+
+            // Finds the line that starts with key in text, and parses the number that follows it, skipping any
+            // whitespace or '=' in between. Returns missing if there's no such line.
+            template <class T>
+            T find_field(const std::string& text, const char* key, T missing) {
+                size_t key_length = strlen(key);
+                for (size_t pos = 0; pos < text.size(); ) {
+                    size_t eol = text.find('\n', pos);
+                    if (eol == std::string::npos) {
+                        eol = text.size();
+                    }
+
+                    if (text.compare(pos, key_length, key) == 0) {
+                        std::istringstream line(text.substr(pos + key_length, eol - pos - key_length));
+                        line >> std::ws;
+                        if (line.peek() == '=') {
+                            line.get();
+                        }
+
+                        T value;
+                        if (line >> value) {
+                            return value;
+                        }
+                    }
+
+                    pos = eol + 1;
+                }
+                return missing;
+            }
+
+            int64_t read_number(const fs::path& path) {
+                std::string s;
+                if (!read_file(path, s)) {
+                    return -1;
+                }
+                try {
+                    return std::stoll(s);
+                } catch (const std::exception&) {
+                    return -1;
+                }
+            }
+
+            // Directory of the cgroup v2 that this process is in, or empty if there isn't one (e.g. only cgroup v1
+            // is mounted). The process never moves to another cgroup on its own, so this is only looked up once.
+            const fs::path& cgroup_dir() {
+                static const fs::path dir = [] {
+                    std::string s;
+                    if (!read_file("/proc/self/cgroup", s)) {
+                        return fs::path();
+                    }
+
+                    // The v2 hierarchy is listed with ID 0 and no controllers.
+                    std::istringstream lines(s);
+                    for (std::string line; std::getline(lines, line); ) {
+                        if (line.compare(0, 3, "0::") == 0) {
+                            auto dir = cgroup_root / boost::algorithm::trim_left_copy_if(line.substr(3), boost::is_any_of("/"));
+                            boost::system::error_code ec;
+                            return fs::exists(dir / "memory.current", ec) || fs::exists(dir / "cgroup.controllers", ec) ? dir : fs::path();
+                        }
+                    }
+                    return fs::path();
+                }();
+                return dir;
+            }
+
+            // memory.max of a cgroup caps its descendants as well, so the effective limit is the smallest one among
+            // the cgroup and all its ancestors. The root cgroup itself has none.
+            int64_t cgroup_limit(const fs::path& dir) {
+                int64_t limit = -1;
+                for (fs::path p = dir; p.string().size() > cgroup_root.string().size(); p = p.parent_path()) {
+                    int64_t max = read_number(p / "memory.max");
+                    if (max >= 0 && (limit < 0 || max < limit)) {
+                        limit = max;
+                    }
+                }
+                return limit;
+            }
+
+            pressure_level compute_level(const status& st, pressure_level previous, const thresholds& limits) {
+                double usage = st.limit > 0 && st.used >= 0 ? double(st.used) / double(st.limit) : 0;
+
+                auto is_above = [&](double threshold, pressure_level level) {
+                    return threshold > 0 && usage >= threshold - (previous >= level ? hysteresis : 0);
+                };
+
+                if (is_above(limits.critical, pressure_level::critical)) {
+                    return pressure_level::critical;
+                } else if (is_above(limits.warning, pressure_level::warning) || (limits.stall > 0 && st.stall_full >= limits.stall)) {
+                    return pressure_level::warning;
+                } else {
+                    return pressure_level::normal;
+                }
+            }
+
+            void monitor_thread(thresholds limits, level_changed_handler level_changed) {
+                for (;;) {
+                    auto st = get_status();
+                    auto previous = st.level;
+                    st.level = compute_level(st, previous, limits);
+                    if (st.level != previous) {
+                        current_level = st.level;
+                        level_changed(st.level, previous, st);
+                    }
+
+                    std::this_thread::sleep_for(poll_interval);
+                }
+            }
+        }
+
+        status get_status() {
+            status st = { current_level.load(), -1, -1, -1, -1, false, -1, -1 };
+            std::string s;
+
+            if (read_file("/proc/self/status", s)) {
+                // These are in kB.
+                int64_t rss = find_field<int64_t>(s, "VmRSS:", -1), rss_peak = find_field<int64_t>(s, "VmHWM:", -1);
+                st.rss = rss >= 0 ? rss * 1024 : -1;
+                st.rss_peak = rss_peak >= 0 ? rss_peak * 1024 : -1;
+            }
+
+            const auto& dir = cgroup_dir();
+            int64_t limit = dir.empty() ? -1 : cgroup_limit(dir);
+            int64_t physical = static_cast<int64_t>(sysconf(_SC_PHYS_PAGES)) * sysconf(_SC_PAGE_SIZE);
+
+            // A cgroup limit that is higher than the amount of physical memory can never be reached before the system
+            // as a whole runs out, so it's the latter that matters then.
+            if (limit >= 0 && (physical <= 0 || limit < physical)) {
+                st.limit = limit;
+                st.is_cgroup_limit = true;
+
+                int64_t current = read_number(dir / "memory.current");
+                if (current >= 0) {
+                    int64_t inactive_file = read_file(dir / "memory.stat", s) ? find_field<int64_t>(s, "inactive_file", 0) : 0;
+                    st.used = std::max<int64_t>(current - inactive_file, 0);
+                }
+            } else if (read_file("/proc/meminfo", s)) {
+                int64_t total = find_field<int64_t>(s, "MemTotal:", -1), available = find_field<int64_t>(s, "MemAvailable:", -1);
+                if (total >= 0 && available >= 0) {
+                    st.limit = total * 1024;
+                    st.used = (total - available) * 1024;
+                }
+            }
+
+            // PSI is only there if the kernel was built with it, and it may also be disabled at boot.
+            if ((!dir.empty() && read_file(dir / "memory.pressure", s)) || read_file("/proc/pressure/memory", s)) {
+                double some = find_field<double>(s, "some avg10", -1), full = find_field<double>(s, "full avg10", -1);
+                st.stall_some = some >= 0 ? some / 100 : -1;
+                st.stall_full = full >= 0 ? full / 100 : -1;
+            }
+
+            return st;
+        }
+
+        void start_monitor(const thresholds& limits, level_changed_handler level_changed) {
+            if (limits.warning <= 0 && limits.critical <= 0 && limits.stall <= 0) {
+                return;
+            }
+            std::thread(monitor_thread, limits, std::move(level_changed)).detach();
+        }
+#endif
+    }
+}
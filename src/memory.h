@@ -0,0 +1,84 @@
+/* ****************************************************************************
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved. 
+ *
+ *
+ * This file is part of Microsoft R Host.
+ * 
+ * Microsoft R Host is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Microsoft R Host is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***************************************************************************/
+
+
+#pragma once
+#include "stdafx.h"
+
+namespace rhost {
+    namespace memory {
+        enum class pressure_level {
+            normal,
+            warning,
+            critical,
+        };
+
+        const char* to_string(pressure_level level);
+
+        struct thresholds {
+            // Fractions of the memory limit; reaching either one raises the pressure level to warning or critical.
+            // Zero disables that threshold; if all thresholds are zero (the default), there's no monitoring at all.
+            double warning;
+            double critical;
+
+            // Fraction of time during which all tasks in the cgroup (or the whole system, outside of one) were stalled
+            // waiting for memory, over the last 10 seconds, as reported by PSI "full avg10". Reaching it raises the
+            // pressure level to at least warning, even if usage is below the limits. Zero disables it.
+            double stall;
+        };
+
+        // Memory figures for this process and whatever limits it. All sizes are in bytes. Values that couldn't be
+        // determined are negative.
+        struct status {
+            pressure_level level;
+
+            // Resident set size of this process, and its peak value since the process started.
+            int64_t rss, rss_peak;
+
+            // The limit that applies to this process, and how much of it is used. If the process is in a cgroup
+            // that has memory.max set on it or on any of its ancestors, limit is the smallest of those, and used
+            // is the working set of the cgroup - memory.current minus inactive file pages, which can be reclaimed
+            // without swapping. This is also what the OOM killer goes by. Otherwise, limit is the total physical
+            // memory, and used is the memory that isn't available to new allocations system-wide.
+            int64_t limit, used;
+            bool is_cgroup_limit;
+
+            // PSI "some avg10" and "full avg10" for memory (as fractions, not percentages), from the cgroup if it has
+            // them, or else system-wide.
+            double stall_some, stall_full;
+        };
+
+        // Reads current figures. level is the one last determined by the monitor, or normal if it's not running.
+        // Can be called from any thread.
+        status get_status();
+
+        picojson::value to_json(const status& st);
+
+        // Starts a background thread that polls memory figures every second, and calls level_changed (on that
+        // thread) whenever the pressure level changes. To avoid flapping, the level only goes down once usage is
+        // somewhat below the threshold that raised it. Only supported on Linux; does nothing elsewhere, or if
+        // monitoring is disabled.
+        typedef std::function<void(pressure_level level, pressure_level previous, const status& st)> level_changed_handler;
+
+        void start_monitor(const thresholds& limits, level_changed_handler level_changed);
+    }
+}
@@ -41,10 +41,10 @@ namespace rhost {
             }
         }
 
-        message::message(message_id request_id, const std::string& name, const std::string& json, const std::vector<char>& blob) :
+        message::message(message_id request_id, const std::string& name, const std::string& json, const char* blob_data, size_t blob_size) :
             _id(last_message_id += 2),
             _request_id(request_id),
-            _payload(sizeof _id + sizeof _request_id + name.size() + 1 + json.size() + 1 + blob.size(), '\0') {
+            _payload(sizeof _id + sizeof _request_id + name.size() + 1 + json.size() + 1 + blob_size, '\0') {
 
             auto& repr = *reinterpret_cast<message_repr*>(&_payload[0]);
             repr.id = _id;
@@ -62,7 +62,9 @@ namespace rhost {
             p += json.size() + 1;
 
             _blob = p - start;
-            memcpy(p, blob.data(), blob.size());
+            if (blob_size) {
+                memcpy(p, blob_data, blob_size);
+            }
         }
 
         message message::parse(std::string&& payload) {
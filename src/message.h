@@ -41,18 +41,30 @@ namespace rhost {
                 _id(0), _request_id(0), _name(0), _json(0), _blob(0) {
             }
 
+            // Messages own their payload, which can be arbitrarily large (e.g. when it carries a blob), so they
+            // are move-only to ensure that the payload is never accidentally copied on its way through the host.
+            message(message&&) = default;
+            message& operator=(message&&) = default;
+
+            message(const message&) = delete;
+            message& operator=(const message&) = delete;
+
             message(message_id request_id, const std::string& name, const picojson::array& json, const std::vector<char>& blob) :
                 message(request_id, name, picojson::value(json).serialize(), blob) {
             }
 
-            message(message_id request_id, const std::string& name, const std::string& json, const std::vector<char>& blob);
-
-            static message parse(std::string&& payload);
+            message(message_id request_id, const std::string& name, const std::string& json, const std::vector<char>& blob) :
+                message(request_id, name, json, blob.data(), blob.size()) {
+            }
 
-            static message parse(const std::string& payload) {
-                return parse(std::string(payload));
+            message(message_id request_id, const std::string& name, const picojson::array& json, const char* blob_data, size_t blob_size) :
+                message(request_id, name, picojson::value(json).serialize(), blob_data, blob_size) {
             }
 
+            message(message_id request_id, const std::string& name, const std::string& json, const char* blob_data, size_t blob_size);
+
+            static message parse(std::string&& payload);
+
             const std::string& payload() const {
                 return _payload;
             }
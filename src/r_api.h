@@ -37,6 +37,7 @@
 
 #ifndef _WIN32
 #include "Rinterface.h"
+#include "R_ext/eventloop.h"
 #endif
 
 #include "Rembedded.h"
@@ -64,6 +65,14 @@ extern "C" {
     extern void run_Rmainloop(void);
     typedef SEXP(*CCODE)(SEXP, SEXP, SEXP, SEXP);
 
+#if R_VERSION < R_Version(3, 5, 0)
+    // Not present before R 3.5, but declared regardless, so that they can be looked up at runtime if the R that is
+    // loaded is newer than the headers; see RHOST_RAPI_SET_OPTIONAL.
+    extern R_xlen_t INTEGER_GET_REGION(SEXP, R_xlen_t, R_xlen_t, int*);
+    extern R_xlen_t LOGICAL_GET_REGION(SEXP, R_xlen_t, R_xlen_t, int*);
+    extern R_xlen_t REAL_GET_REGION(SEXP, R_xlen_t, R_xlen_t, double*);
+#endif
+
     enum {
         R_32_GE_version = 10,
         R_33_GE_version = 11,
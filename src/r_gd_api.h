@@ -68,7 +68,7 @@ namespace rhost {
             typedef decltype(dummy(static_cast<typename subst<From, To, Result(*)(Args...)>::type>(nullptr))) type;
         };
 
-#define RHOST_GD_MEMBER_DECL(x) static subst<::DevDesc, DevDesc, decltype(::x)*>::type x;
+#define RHOST_GD_MEMBER_DECL(x) static rapi_slot<subst<::DevDesc, DevDesc, decltype(::x)*>::type>::type x;
 
 #define RHOST_DEVDESC_MEMBER(x) subst<::DevDesc, DevDesc, decltype(::DevDesc::x)>::type x;
 
@@ -27,6 +27,7 @@
 #include "blobs.h"
 #include "project.h"
 #include "json.h"
+#include "eval.h"
 #include "exports.h"
 #include "rstrtmgr.h"
 
@@ -286,7 +287,24 @@ namespace rhost {
             });
         }
 
+        extern "C" SEXP post_notification(SEXP name_sexp, SEXP args_sexp, SEXP coalescing_key_sexp) {
+            return with_cancellation([&] {
+                protected_sexp name_char(Rf_asChar(name_sexp));
+                const char* name = R_CHAR(name_char.get());
+
+                std::string coalescing_key;
+                if (coalescing_key_sexp != R_NilValue) {
+                    protected_sexp key_char(Rf_asChar(coalescing_key_sexp));
+                    coalescing_key = R_CHAR(key_char.get());
+                }
+
+                host::post_notification(name, parse_args_sexp(args_sexp), coalescing_key);
+                return R_NilValue;
+            });
+        }
+
         extern "C" SEXP send_request_and_get_response(SEXP name_sexp, SEXP args_sexp) {
+            check_not_forked_child("send_request_and_get_response");
             return with_cancellation([&] {
                 protected_sexp name_char(Rf_asChar(name_sexp));
                 const char* name = R_CHAR(name_char.get());
@@ -459,6 +477,7 @@ namespace rhost {
         }
 
         extern "C" SEXP create_blob(SEXP obj) {
+            check_not_forked_child("create_blob");
             int type = TYPEOF(obj);
             size_t length = Rf_length(obj);
 
@@ -472,6 +491,7 @@ namespace rhost {
         }
 
         extern "C" SEXP create_compressed_blob(SEXP obj) {
+            check_not_forked_child("create_compressed_blob");
             int type = TYPEOF(obj);
             size_t length = Rf_length(obj);
 
@@ -485,6 +505,7 @@ namespace rhost {
         }
 
         extern "C" SEXP get_blob(SEXP id) {
+            check_not_forked_child("get_blob");
             auto blob_id = static_cast<blobs::blob_id>(Rf_asReal(id));
             auto data = rhost::host::get_blob(blob_id);
 
@@ -499,6 +520,7 @@ namespace rhost {
         }
 
         extern "C" SEXP destroy_blob(SEXP id) {
+            check_not_forked_child("destroy_blob");
             auto blob_id = static_cast<blobs::blob_id>(Rf_asReal(id));
             rhost::host::destroy_blob(blob_id);
             return R_NilValue;
@@ -518,6 +540,7 @@ namespace rhost {
         }
 
         extern "C" SEXP fetch_file(SEXP remotePath, SEXP localPath, SEXP silent) {
+            check_not_forked_child("fetch_file");
             return util::exceptions_to_errors([&]() {
                 fs::path file_remote_path = rhost::util::path_from_string_elt(STRING_ELT(remotePath, 0));
                 fs::path file_local_path = rhost::util::path_from_string_elt(STRING_ELT(localPath, 0));;
@@ -535,6 +558,7 @@ namespace rhost {
         }
 
         extern "C" SEXP save_to_project_folder(SEXP id, SEXP project_name, SEXP dest_dir, SEXP temp_dir) {
+            check_not_forked_child("save_to_project_folder");
             auto blob_id = static_cast<blobs::blob_id>(Rf_asReal(id));
             util::exceptions_to_errors([&]() {
                 fs::path path_prj_name = rhost::util::path_from_string_elt(STRING_ELT(project_name, 0));
@@ -547,6 +571,44 @@ namespace rhost {
             return R_NilValue;
         }
 
+        extern "C" SEXP parse_cache_stats() {
+            auto stats = eval::get_parse_cache_stats();
+            const std::pair<const char*, double> fields[] = {
+                { "hits", static_cast<double>(stats.hits) },
+                { "misses", static_cast<double>(stats.misses) },
+                { "compiled", static_cast<double>(stats.compiled) },
+                { "size", static_cast<double>(stats.size) },
+                { "capacity", static_cast<double>(stats.capacity) },
+            };
+            const int count = sizeof fields / sizeof fields[0];
+
+            SEXP result = Rf_protect(Rf_allocVector(REALSXP, count));
+            SEXP names = Rf_protect(Rf_allocVector(STRSXP, count));
+            for (int i = 0; i < count; ++i) {
+                REAL(result)[i] = fields[i].second;
+                SET_STRING_ELT(names, i, Rf_mkChar(fields[i].first));
+            }
+            Rf_setAttrib(result, R_NamesSymbol, names);
+
+            Rf_unprotect(2);
+            return result;
+        }
+
+        extern "C" SEXP parse_cache_clear() {
+            eval::clear_parse_cache();
+            return R_NilValue;
+        }
+
+        extern "C" SEXP host_stats() {
+            check_not_forked_child("host_stats");
+            SEXP json = Rf_mkCharCE(rhost::host::get_stats().serialize().c_str(), CE_UTF8);
+            Rf_protect(json);
+            SEXP result = Rf_allocVector(STRSXP, 1);
+            SET_STRING_ELT(result, 0, json);
+            Rf_unprotect(1);
+            return result;
+        }
+
         protected_sexp disconnect_callback;
 
         extern "C" SEXP set_disconnect_callback(SEXP func) {
@@ -564,6 +626,7 @@ namespace rhost {
             { "Microsoft.R.Host::Call.memory_connection_tochar", (DL_FUNC)memory_connection_tochar, 1 },
             { "Microsoft.R.Host::Call.memory_connection_overflown", (DL_FUNC)memory_connection_overflown, 1 },
             { "Microsoft.R.Host::Call.send_notification", (DL_FUNC)send_notification, 2 },
+            { "Microsoft.R.Host::Call.post_notification", (DL_FUNC)post_notification, 3 },
             { "Microsoft.R.Host::Call.send_request_and_get_response", (DL_FUNC)send_request_and_get_response, 2 },
             { "Microsoft.R.Host::Call.set_instrumentation_callback", (DL_FUNC)set_instrumentation_callback, 1 },
             { "Microsoft.R.Host::Call.is_rdebug", (DL_FUNC)is_rdebug, 1 },
@@ -579,6 +642,9 @@ namespace rhost {
             { "Microsoft.R.Host::Call.save_to_project_folder", (DL_FUNC)save_to_project_folder, 4 },
             { "Microsoft.R.Host::Call.set_disconnect_callback", (DL_FUNC)set_disconnect_callback, 1 },
             { "Microsoft.R.Host::Call.get_disconnect_callback", (DL_FUNC)get_disconnect_callback, 0 },
+            { "Microsoft.R.Host::Call.parse_cache_stats", (DL_FUNC)parse_cache_stats, 0 },
+            { "Microsoft.R.Host::Call.parse_cache_clear", (DL_FUNC)parse_cache_clear, 0 },
+            { "Microsoft.R.Host::Call.host_stats", (DL_FUNC)host_stats, 0 },
             { }
         };
 
@@ -0,0 +1,257 @@
+/* ****************************************************************************
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved. 
+ *
+ *
+ * This file is part of Microsoft R Host.
+ * 
+ * Microsoft R Host is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Microsoft R Host is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***************************************************************************/
+
+#include "stdafx.h"
+#include "stats.h"
+#include "util.h"
+#include "r_api.h"
+#include "log.h"
+
+using namespace rhost::util;
+
+namespace rhost {
+    namespace stats {
+        log2_histogram eval_parse_time, eval_eval_time, eval_serialize_time, eval_send_time, eval_gc_time, eval_result_size;
+        std::atomic<int64_t> eval_queue_length{ 0 };
+        log2_histogram eval_queue_depth, eval_queue_wait_time;
+        log2_histogram plot_render_time;
+        log2_histogram transport_stall_time;
+        log2_histogram workspace_tracking_time;
+        log2_histogram memory_relief_time;
+
+        namespace {
+            const auto start_time = std::chrono::steady_clock::now();
+
+            // Fixed-size open addressing hash table, so that lookups can run concurrently with insertions without
+            // locking. Slots are claimed by CAS on the hash, and only become visible to readers once the name has
+            // been filled in. Once all slots are taken, new names are counted under the last, catch-all slot.
+            struct message_counter {
+                static const size_t max_name_length = 63;
+
+                std::atomic<uint64_t> hash{ 0 };
+                std::atomic<bool> is_ready{ false };
+                char name[max_name_length + 1];
+                std::atomic<uint64_t> in_count{ 0 }, in_bytes{ 0 }, out_count{ 0 }, out_bytes{ 0 };
+            };
+
+            const size_t message_counter_count = 128;
+            message_counter message_counters[message_counter_count + 1];
+            message_counter& other_messages = message_counters[message_counter_count];
+
+            message_counter& get_message_counter(const char* name, size_t length) {
+                // FNV-1a; 0 is reserved for empty slots.
+                uint64_t hash = 14695981039346656037ULL;
+                for (size_t i = 0; i < length; ++i) {
+                    hash = (hash ^ static_cast<unsigned char>(name[i])) * 1099511628211ULL;
+                }
+                if (hash == 0) {
+                    hash = 1;
+                }
+
+                for (size_t i = 0; i < message_counter_count; ++i) {
+                    auto& counter = message_counters[(hash + i) % message_counter_count];
+
+                    uint64_t slot_hash = counter.hash.load(std::memory_order_relaxed);
+                    // If someone else claims the slot first, the failed CAS updates slot_hash to their hash.
+                    if (slot_hash == 0 && counter.hash.compare_exchange_strong(slot_hash, hash, std::memory_order_relaxed)) {
+                        length = std::min(length, message_counter::max_name_length);
+                        memcpy(counter.name, name, length);
+                        counter.name[length] = '\0';
+                        counter.is_ready.store(true, std::memory_order_release);
+                        return counter;
+                    }
+
+                    if (slot_hash == hash) {
+                        return counter;
+                    }
+                }
+
+                return other_messages;
+            }
+        }
+
+        void record_message(bool incoming, const char* name, size_t size) {
+            size_t length = strlen(name);
+            if (length >= 2 && (name[0] == '?' || name[0] == ':') && name[1] == '=') {
+                // Keep "?=*" separate from "?=", but drop the flags otherwise.
+                length = (name[2] == '*') ? 3 : 2;
+            }
+
+            auto& counter = get_message_counter(name, length);
+            if (incoming) {
+                counter.in_count.fetch_add(1, std::memory_order_relaxed);
+                counter.in_bytes.fetch_add(size, std::memory_order_relaxed);
+            } else {
+                counter.out_count.fetch_add(1, std::memory_order_relaxed);
+                counter.out_bytes.fetch_add(size, std::memory_order_relaxed);
+            }
+        }
+
+        picojson::value message_stats() {
+            picojson::object result;
+
+            for (const auto& counter : message_counters) {
+                const char* name;
+                if (&counter == &other_messages) {
+                    name = "*";
+                } else if (counter.is_ready.load(std::memory_order_acquire)) {
+                    name = counter.name;
+                } else {
+                    continue;
+                }
+
+                picojson::object entry;
+                entry["in_count"] = picojson::value(static_cast<double>(counter.in_count.load(std::memory_order_relaxed)));
+                entry["in_bytes"] = picojson::value(static_cast<double>(counter.in_bytes.load(std::memory_order_relaxed)));
+                entry["out_count"] = picojson::value(static_cast<double>(counter.out_count.load(std::memory_order_relaxed)));
+                entry["out_bytes"] = picojson::value(static_cast<double>(counter.out_bytes.load(std::memory_order_relaxed)));
+                result[name] = picojson::value(std::move(entry));
+            }
+
+            return picojson::value(std::move(result));
+        }
+
+        std::chrono::steady_clock::duration uptime() {
+            return std::chrono::steady_clock::now() - start_time;
+        }
+
+        namespace {
+            std::vector<std::pair<std::string, double>> startup_phase_times;
+            std::chrono::steady_clock::time_point last_startup_phase_end = start_time;
+            std::mutex startup_phases_mutex;
+        }
+
+        void end_startup_phase(const char* name) {
+            auto now = std::chrono::steady_clock::now();
+            double ms;
+            {
+                std::lock_guard<std::mutex> lock(startup_phases_mutex);
+                ms = std::chrono::duration<double, std::milli>(now - last_startup_phase_end).count();
+                last_startup_phase_end = now;
+                startup_phase_times.emplace_back(name, ms);
+            }
+
+            log::logf(log::log_verbosity::minimal, "Startup phase '%s' took %.1f ms.\n", name, ms);
+        }
+
+        picojson::value startup_phases() {
+            std::lock_guard<std::mutex> lock(startup_phases_mutex);
+
+            picojson::array result;
+            for (const auto& phase : startup_phase_times) {
+                picojson::array entry;
+                entry.push_back(picojson::value(phase.first));
+                entry.push_back(picojson::value(phase.second));
+                result.push_back(picojson::value(std::move(entry)));
+            }
+            return picojson::value(std::move(result));
+        }
+
+        void log2_histogram::record(uint64_t value) {
+            size_t bucket = 0;
+            for (uint64_t v = value; v != 0; v >>= 1) {
+                ++bucket;
+            }
+
+            _buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+            _count.fetch_add(1, std::memory_order_relaxed);
+            _sum.fetch_add(value, std::memory_order_relaxed);
+        }
+
+        picojson::value log2_histogram::to_json() const {
+            size_t used = bucket_count;
+            while (used > 0 && _buckets[used - 1].load(std::memory_order_relaxed) == 0) {
+                --used;
+            }
+
+            picojson::array buckets;
+            buckets.reserve(used);
+            for (size_t i = 0; i < used; ++i) {
+                buckets.push_back(picojson::value(static_cast<double>(_buckets[i].load(std::memory_order_relaxed))));
+            }
+
+            picojson::object result;
+            result["count"] = picojson::value(static_cast<double>(_count.load(std::memory_order_relaxed)));
+            result["sum"] = picojson::value(static_cast<double>(_sum.load(std::memory_order_relaxed)));
+            result["buckets"] = picojson::value(std::move(buckets));
+            return picojson::value(std::move(result));
+        }
+
+        picojson::value eval_histograms() {
+            picojson::object result;
+            result["parse_us"] = eval_parse_time.to_json();
+            result["eval_us"] = eval_eval_time.to_json();
+            result["serialize_us"] = eval_serialize_time.to_json();
+            result["send_us"] = eval_send_time.to_json();
+            result["gc_us"] = eval_gc_time.to_json();
+            result["result_bytes"] = eval_result_size.to_json();
+            return picojson::value(std::move(result));
+        }
+
+        namespace {
+            uint64_t gc_count;
+
+            void arm_gc_sentinel();
+
+            void gc_sentinel_finalizer(SEXP) {
+                ++gc_count;
+                arm_gc_sentinel();
+            }
+
+            void arm_gc_sentinel() {
+                // The sentinel is not referenced from anywhere, so the very next collection will reclaim it.
+                SEXP sentinel = R_MakeExternalPtr(nullptr, R_NilValue, R_NilValue);
+                R_RegisterCFinalizerEx(sentinel, gc_sentinel_finalizer, R_FALSE);
+            }
+        }
+
+        uint64_t r_gc_count() {
+            static bool is_armed = false;
+            if (!is_armed) {
+                is_armed = true;
+                arm_gc_sentinel();
+            }
+
+            R_RunPendingFinalizers();
+            return gc_count;
+        }
+
+        std::chrono::duration<double> r_gc_time() {
+            static protected_sexp call;
+            if (!call) {
+                call = Rf_allocList(1);
+                SET_TYPEOF(call.get(), LANGSXP);
+                SETCAR(call.get(), Rf_install("gc.time"));
+            }
+
+            // gc.time() returns user, system and elapsed times; the last one is what we want.
+            double elapsed = 0;
+            r_top_level_exec([&] {
+                SEXP times = Rf_eval(call.get(), R_BaseEnv);
+                if (TYPEOF(times) == REALSXP && Rf_length(times) >= 3) {
+                    elapsed = REAL(times)[2];
+                }
+            });
+            return std::chrono::duration<double>(elapsed);
+        }
+    }
+}
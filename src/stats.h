@@ -0,0 +1,114 @@
+/* ****************************************************************************
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved. 
+ *
+ *
+ * This file is part of Microsoft R Host.
+ * 
+ * Microsoft R Host is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Microsoft R Host is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***************************************************************************/
+
+#pragma once
+#include "stdafx.h"
+
+namespace rhost {
+    namespace stats {
+        // Histogram of non-negative integer values with power-of-two buckets: bucket 0 counts zeros, and bucket i > 0
+        // counts values in [2^(i-1), 2^i). Recording only does relaxed atomic increments, so it's safe to use from any
+        // thread, and is cheap enough for hot paths. Readers may observe a slightly inconsistent snapshot.
+        class log2_histogram {
+        public:
+            // Enough for any uint64_t: values of 2^63 and above go in bucket 64.
+            static const size_t bucket_count = 65;
+
+            log2_histogram() {
+                for (auto& bucket : _buckets) {
+                    bucket = 0;
+                }
+            }
+
+            void record(uint64_t value);
+
+            // Negative durations (e.g. from a clock that isn't steady) are recorded as zero.
+            template <class Rep, class Period>
+            void record(std::chrono::duration<Rep, Period> duration) {
+                auto us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+                record(static_cast<uint64_t>(us > 0 ? us : 0));
+            }
+
+            // Produces {"count": n, "sum": s, "buckets": [...]}, where trailing empty buckets are omitted.
+            picojson::value to_json() const;
+
+        private:
+            std::atomic<uint64_t> _buckets[bucket_count];
+            std::atomic<uint64_t> _count{ 0 }, _sum{ 0 };
+
+            log2_histogram(const log2_histogram&) = delete;
+            log2_histogram& operator=(const log2_histogram&) = delete;
+        };
+
+        // Aggregate timings (in microseconds) and sizes (in bytes) for all '?=' evals.
+        extern log2_histogram eval_parse_time, eval_eval_time, eval_serialize_time, eval_send_time, eval_gc_time, eval_result_size;
+
+        picojson::value eval_histograms();
+
+        // Number of eval requests that are queued but haven't started executing yet; how many there were (including
+        // the new one) every time one was queued; and how long (in microseconds) each one spent in the queue.
+        extern std::atomic<int64_t> eval_queue_length;
+        extern log2_histogram eval_queue_depth, eval_queue_wait_time;
+
+        // Time (in microseconds) taken to render a plot and save it to a file.
+        extern log2_histogram plot_render_time;
+
+        // Time (in microseconds) that threads spent in transport::send_message, including waiting for other threads to
+        // finish sending, and for the client to read enough from the pipe for the write to complete.
+        extern log2_histogram transport_stall_time;
+
+        // Time (in microseconds) taken on every prompt to determine changes in tracked environments.
+        extern log2_histogram workspace_tracking_time;
+
+        // Time (in microseconds) taken to free memory after the memory monitor reported increased pressure, including GC.
+        extern log2_histogram memory_relief_time;
+
+        // Records a message that went through the transport, with the size of its entire payload. Messages are grouped
+        // by name, except that eval requests and their responses are grouped without their flags. Recording a message
+        // with a name that was seen before does not lock or allocate.
+        void record_message(bool incoming, const char* name, size_t size);
+
+        // Produces {name: {in_count, in_bytes, out_count, out_bytes}, ...} for all names recorded so far.
+        picojson::value message_stats();
+
+        // Time since the host process started.
+        std::chrono::steady_clock::duration uptime();
+
+        // Startup is broken down into named phases, each of which is timed from the end of the previous one (or from the
+        // start of the process, for the first one). Also logs the duration of the phase.
+        void end_startup_phase(const char* name);
+
+        // Produces [[name, ms], ...] for all phases that ended so far, in order.
+        picojson::value startup_phases();
+
+        // Number of garbage collections observed since the first call to this function. R does not expose a counter
+        // for this, so it is tracked by a finalizer on a sentinel object that is re-created every time it runs. Pending
+        // finalizers are run first, so the count includes any collections that happened before the call. This is a
+        // lower bound, since several collections may occur before finalizers get a chance to run.
+        //
+        // Must be called on the R thread.
+        uint64_t r_gc_count();
+
+        // Cumulative time spent in garbage collection, as reported by gc.time(). Must be called on the R thread.
+        std::chrono::duration<double> r_gc_time();
+    }
+}
@@ -30,6 +30,7 @@
 #include <atomic>
 #include <cstdarg>
 #include <cinttypes>
+#include <cmath>
 #include <codecvt>
 #include <chrono>
 #include <condition_variable>
@@ -39,15 +40,19 @@
 #include <fstream>
 #include <future>
 #include <iostream>
+#include <list>
 #include <memory>
 #include <mutex>
+#include <numeric>
 #include <queue>
+#include <set>
 #include <string>
 #include <thread>
 #include <tuple>
 #include <type_traits>
 #include <utility>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <stdexcept>
 
@@ -103,6 +108,13 @@
 #else // linux
 #include <unistd.h>
 #include <dlfcn.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #endif
 
 namespace fs = boost::filesystem;
@@ -22,6 +22,7 @@
 
 #include "blobs.h"
 #include "transport.h"
+#include "stats.h"
 
 using namespace rhost::protocol;
 
@@ -37,9 +38,10 @@ namespace rhost {
 
             std::atomic<bool> connected;
             FILE *input, *output;
+            int input_fd = -1, output_fd = -1;
             std::mutex output_lock;
 
-            void log_message(const char* prefix, message_id id, message_id request_id, const char* name, const char* json, const blobs::blob& blob) {
+            void log_message(const char* prefix, message_id id, message_id request_id, const char* name, const char* json, size_t blob_size) {
 #ifdef TRACE_JSON
                 std::ostringstream str;
                 str << prefix << " #" << id << "# " << name;
@@ -50,8 +52,8 @@ namespace rhost {
 
                 str << " " << json;
 
-                if (!blob.empty()) {
-                    str << " <raw (" << blob.size() << " bytes)>";
+                if (blob_size) {
+                    str << " <raw (" << blob_size << " bytes)>";
                 }
 
                 log::logf(log::log_verbosity::traffic, "%s\n\n", str.str().c_str());
@@ -78,8 +80,9 @@ namespace rhost {
                         }
                     }
 
-                    auto msg = message::parse(payload);
-                    log_message("==>", msg.id(), msg.request_id(), msg.name(), msg.json_text(), msg.blob());
+                    auto msg = message::parse(std::move(payload));
+                    log_message("==>", msg.id(), msg.request_id(), msg.name(), msg.json_text(), msg.blob_size());
+                    stats::record_message(true, msg.name(), msg.payload().size());
                     message_received(msg);
                 }
 
@@ -87,22 +90,28 @@ namespace rhost {
             }
         }
 
-        boost::signals2::signal<void(const protocol::message&)> message_received;
+        boost::signals2::signal<void(protocol::message&)> message_received;
 
         boost::signals2::signal<void()> disconnected;
 
         void initialize() {
-            assert(!input && !output);
-
 #ifdef _WIN32
             setmode(fileno(stdin), _O_BINARY);
             setmode(fileno(stdout), _O_BINARY);
 #endif
 
             // Duplicate and stash away handles for original stdin & stdout.
-            input = fdopen(dup(fileno(stdin)), "rb");
+            initialize(dup(fileno(stdin)), dup(fileno(stdout)));
+        }
+
+        void initialize(int input_fd, int output_fd) {
+            assert(!input && !output);
+
+            transport::input_fd = input_fd;
+            transport::output_fd = output_fd;
+            input = fdopen(input_fd, "rb");
             setvbuf(input, NULL, _IONBF, 0);
-            output = fdopen(dup(fileno(stdout)), "wb");
+            output = fdopen(output_fd, "wb");
             setvbuf(output, NULL, _IONBF, 0);
 
             // Redirect stdin and stdout to the null device, so that any code trying to write directly
@@ -115,30 +124,90 @@ namespace rhost {
         }
 
         void send_message(const message& msg) {
+            send_message(msg, nullptr, 0);
+        }
+
+        void send_message(const message& msg, const char* blob_data, size_t blob_size) {
             assert(output);
+            assert(!blob_size || !msg.blob_size());
 
-            log_message("<==", msg.id(), msg.request_id(), msg.name(), msg.json_text(), msg.blob());
+            log_message("<==", msg.id(), msg.request_id(), msg.name(), msg.json_text(), msg.blob_size() + blob_size);
 
             if (!connected) {
                 return;
             }
 
             auto& payload = msg.payload();
-            boost::endian::little_uint32_buf_t msg_size(static_cast<uint32_t>(payload.size()));
+            boost::endian::little_uint32_buf_t msg_size(static_cast<uint32_t>(payload.size() + blob_size));
+            stats::record_message(false, msg.name(), payload.size() + blob_size);
+
+            auto start = std::chrono::steady_clock::now();
+            SCOPE_WARDEN(record_stall, {
+                stats::transport_stall_time.record(std::chrono::steady_clock::now() - start);
+            });
 
             std::lock_guard<std::mutex> lock(output_lock);
             if (fwrite(&msg_size, sizeof msg_size, 1, output) == 1) {
                 if (fwrite(payload.data(), payload.size(), 1, output) == 1) {
-                    fflush(output);
-                    return;
+                    if (!blob_size || fwrite(blob_data, blob_size, 1, output) == 1) {
+                        fflush(output);
+                        return;
+                    }
                 }
             }
 
             disconnect();
         }
 
+        void send_messages(const std::vector<protocol::message>& msgs) {
+            assert(output);
+
+            size_t total_size = 0;
+            for (const auto& msg : msgs) {
+                log_message("<==", msg.id(), msg.request_id(), msg.name(), msg.json_text(), msg.blob_size());
+                stats::record_message(false, msg.name(), msg.payload().size());
+                total_size += sizeof(boost::endian::little_uint32_buf_t) + msg.payload().size();
+            }
+
+            if (!connected || msgs.empty()) {
+                return;
+            }
+
+            // Concatenate everything so that it takes a single write.
+            std::string buffer;
+            buffer.reserve(total_size);
+            for (const auto& msg : msgs) {
+                auto& payload = msg.payload();
+                boost::endian::little_uint32_buf_t msg_size(static_cast<uint32_t>(payload.size()));
+                buffer.append(reinterpret_cast<const char*>(&msg_size), sizeof msg_size);
+                buffer.append(payload);
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            SCOPE_WARDEN(record_stall, {
+                stats::transport_stall_time.record(std::chrono::steady_clock::now() - start);
+            });
+
+            std::lock_guard<std::mutex> lock(output_lock);
+            if (fwrite(buffer.data(), buffer.size(), 1, output) == 1) {
+                fflush(output);
+                return;
+            }
+
+            disconnect();
+        }
+
         bool is_connected() {
             return connected;
         }
+
+#ifndef _WIN32
+        void close_in_forked_child() {
+            // The FILEs are unbuffered, and may be locked by the receive worker of the parent, so bypass them.
+            connected = false;
+            close(input_fd);
+            close(output_fd);
+        }
+#endif
     }
 }
\ No newline at end of file
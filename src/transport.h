@@ -26,14 +26,33 @@
 
 namespace rhost {
     namespace transport {
-        extern boost::signals2::signal<void(const protocol::message&)> message_received;
+        // Slots can take ownership of the message by moving from it.
+        extern boost::signals2::signal<void(protocol::message&)> message_received;
 
         extern boost::signals2::signal<void()> disconnected;
 
+        // Uses stdin and stdout of the process to communicate with the client.
         void initialize();
 
+        // Uses the provided file descriptors to communicate with the client, taking ownership of them.
+        void initialize(int input_fd, int output_fd);
+
         void send_message(const protocol::message& msg);
 
+        // Sends msg with the provided bytes as its blob, writing them directly from where they are, rather than
+        // copying them into the message payload first. msg itself must not have a blob.
+        void send_message(const protocol::message& msg, const char* blob_data, size_t blob_size);
+
+        // Sends all messages in order in a single write, so that no other message can be interleaved with them.
+        void send_messages(const std::vector<protocol::message>& msgs);
+
         bool is_connected();
+
+#ifndef _WIN32
+        // Must be called in a child process forked from the host, before it runs any R code. Closes the child's copies
+        // of the transport file descriptors, so that the child can't write into the client connection, and marks the
+        // transport as disconnected, without raising disconnected - no slots are run in the child.
+        void close_in_forked_child();
+#endif
     }
 }
@@ -142,5 +142,35 @@ namespace rhost {
             return fs::path(Rf_translateCharUTF8(string_elt));
 #endif
         }
+
+#ifndef _WIN32
+        bool write_all(int fd, const char* data, size_t size) {
+            for (size_t written = 0; written < size;) {
+                ssize_t n = write(fd, data + written, size - written);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    return false;
+                }
+                written += n;
+            }
+            return true;
+        }
+
+        void read_all(int fd, std::string& s) {
+            char buf[0x10000];
+            for (;;) {
+                ssize_t n = read(fd, buf, sizeof buf);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    return;
+                }
+                s.append(buf, n);
+            }
+        }
+#endif
     }
 }
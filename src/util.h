@@ -118,6 +118,73 @@ namespace rhost {
             }
         };
 
+        // An unbounded FIFO queue that any number of threads can push to concurrently without locking, and that a
+        // single thread can pop from. Checking whether there's anything to pop is a single acquire load of the next
+        // pointer of the node at the consumer's end, with no locking or read-modify-write, so it's cheap enough to do
+        // on every iteration of a polling loop. Producers write that pointer only when they push onto an empty queue;
+        // otherwise they only touch _head and the node at the producers' end.
+        //
+        // This is an intrusive linked list with a stub node (D. Vyukov's MPSC queue). A push becomes visible to the
+        // consumer once the producer links the node in; until then, the queue may briefly appear empty to the consumer
+        // even though the push has started, so the producer must notify the consumer after push() returns.
+        template<class T>
+        class mpsc_queue {
+        public:
+            mpsc_queue()
+                : _head(new node), _tail(_head.load(std::memory_order_relaxed)) {
+            }
+
+            ~mpsc_queue() {
+                while (_tail) {
+                    node* next = _tail->next.load(std::memory_order_relaxed);
+                    delete _tail;
+                    _tail = next;
+                }
+            }
+
+            // Can be called from any thread.
+            void push(T&& value) {
+                node* n = new node(std::move(value));
+                node* prev = _head.exchange(n, std::memory_order_acq_rel);
+                prev->next.store(n, std::memory_order_release);
+            }
+
+            // Can only be called from the consumer thread.
+            bool empty() const {
+                return _tail->next.load(std::memory_order_acquire) == nullptr;
+            }
+
+            // Can only be called from the consumer thread. Returns false if there was nothing to pop.
+            bool try_pop(T& value) {
+                node* next = _tail->next.load(std::memory_order_acquire);
+                if (!next) {
+                    return false;
+                }
+
+                // next becomes the new stub node, so its value is moved out, but the node itself stays.
+                value = std::move(next->value);
+                delete _tail;
+                _tail = next;
+                return true;
+            }
+
+        private:
+            struct node {
+                std::atomic<node*> next;
+                T value;
+
+                node() : next(nullptr) {}
+                explicit node(T&& value) : next(nullptr), value(std::move(value)) {}
+            };
+
+            // Producers and the consumer touch different ends, so keep them on separate cache lines.
+            alignas(64) std::atomic<node*> _head;
+            alignas(64) node* _tail;
+
+            mpsc_queue(const mpsc_queue&) = delete;
+            mpsc_queue& operator=(const mpsc_queue&) = delete;
+        };
+
 #ifdef _WIN32
         std::string Rchar_to_utf8(const char* buf, size_t len);
 
@@ -147,6 +214,14 @@ namespace rhost {
 
         fs::path path_from_string_elt(SEXP string_elt);
 
+#ifndef _WIN32
+        // Writes all of data to fd, retrying after partial writes and EINTR. Returns false if writing fails.
+        bool write_all(int fd, const char* data, size_t size);
+
+        // Reads from fd until EOF or error, appending everything that was read to s.
+        void read_all(int fd, std::string& s);
+#endif
+
         inline void append(picojson::array& msg) {
         }
 
@@ -0,0 +1,363 @@
+/* ****************************************************************************
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved. 
+ *
+ *
+ * This file is part of Microsoft R Host.
+ * 
+ * Microsoft R Host is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Microsoft R Host is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***************************************************************************/
+
+
+#include "stdafx.h"
+#include "workspace.h"
+#include "util.h"
+
+using namespace rhost::util;
+
+namespace rhost {
+    namespace workspace {
+        namespace {
+            // Sizes of R heap objects on 64-bit platforms, which is what object.size() reports as well:
+            // sizeof(SEXPREC_ALIGN) for vectors, and sizeof(SEXPREC) for everything else.
+            const size_t vector_header_size = 48;
+            const size_t node_size = 56;
+
+            // To keep the cost of summarizing bounded, sizing an object stops after this many distinct
+            // objects reachable from it have been visited; its size is then a lower bound.
+            const size_t max_sized_objects = 1000000;
+
+            size_t element_size(int type) {
+                switch (type) {
+                case CHARSXP:
+                case RAWSXP:
+                    return 1;
+                case LGLSXP:
+                case INTSXP:
+                    return 4;
+                case REALSXP:
+                    return 8;
+                case CPLXSXP:
+                    return 16;
+                case STRSXP:
+                case VECSXP:
+                case EXPRSXP:
+                    return sizeof(SEXP);
+                default:
+                    return 0;
+                }
+            }
+
+            // Approximates the memory used by an object the same way object.size() does, except that every object
+            // reachable from it is counted only once, no matter how many references to it there are - so, e.g.,
+            // a list that contains the same vector twice, or strings that repeat the same value, are not overcounted.
+            // Like object.size(), it doesn't count environments that the object references, nor symbols, which are
+            // shared by everything.
+            uint64_t object_size(SEXP sexp) {
+                std::unordered_set<SEXP> visited;
+                std::vector<SEXP> pending{ sexp };
+                uint64_t size = 0;
+
+                while (!pending.empty() && visited.size() < max_sized_objects) {
+                    SEXP x = pending.back();
+                    pending.pop_back();
+                    if (x == R_NilValue || !visited.insert(x).second) {
+                        continue;
+                    }
+
+                    int type = TYPEOF(x);
+                    switch (type) {
+                    case SYMSXP:
+                        continue;
+                    case CHARSXP:
+                    case LGLSXP:
+                    case INTSXP:
+                    case REALSXP:
+                    case CPLXSXP:
+                    case STRSXP:
+                    case VECSXP:
+                    case EXPRSXP:
+                    case RAWSXP: {
+                        uint64_t length = Rf_xlength(x);
+                        if (type == CHARSXP) {
+                            ++length; // null terminator
+                        }
+                        size += vector_header_size + ((length * element_size(type) + 7) & ~uint64_t(7));
+
+                        if (type == STRSXP) {
+                            for (R_xlen_t i = 0; i < static_cast<R_xlen_t>(length); ++i) {
+                                pending.push_back(STRING_ELT(x, i));
+                            }
+                        } else if (type == VECSXP || type == EXPRSXP) {
+                            for (R_xlen_t i = 0; i < static_cast<R_xlen_t>(length); ++i) {
+                                pending.push_back(VECTOR_ELT(x, i));
+                            }
+                        }
+                        break;
+                    }
+                    case LISTSXP:
+                    case LANGSXP:
+                    case DOTSXP:
+                        size += node_size;
+                        pending.push_back(CDR(x));
+                        pending.push_back(CAR(x));
+                        break;
+                    default:
+                        size += node_size;
+                        break;
+                    }
+
+                    pending.push_back(ATTRIB(x));
+                }
+
+                return size;
+            }
+
+            // Looks up an attribute without going through Rf_getAttrib, which expands compact row names.
+            SEXP raw_attrib(SEXP sexp, SEXP name) {
+                for (SEXP a = ATTRIB(sexp); a != R_NilValue; a = CDR(a)) {
+                    if (TAG(a) == name) {
+                        return CAR(a);
+                    }
+                }
+                return R_NilValue;
+            }
+
+            bool inherits(SEXP klass, const char* name) {
+                for (R_xlen_t i = 0; i < Rf_xlength(klass); ++i) {
+                    if (!strcmp(R_CHAR(STRING_ELT(klass, i)), name)) {
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            // Same as class() would return.
+            picojson::value class_to_json(SEXP klass, SEXP dims, int type) {
+                picojson::array result;
+                if (TYPEOF(klass) == STRSXP && Rf_xlength(klass) > 0) {
+                    for (R_xlen_t i = 0; i < Rf_xlength(klass); ++i) {
+                        result.push_back(picojson::value(Rchar_to_utf8(R_CHAR(STRING_ELT(klass, i)))));
+                    }
+                    return picojson::value(std::move(result));
+                }
+
+                if (TYPEOF(dims) == INTSXP) {
+                    if (Rf_xlength(dims) == 2) {
+                        result.push_back(picojson::value("matrix"));
+                    }
+                    result.push_back(picojson::value("array"));
+                    return picojson::value(std::move(result));
+                }
+
+                const char* implicit;
+                switch (type) {
+                case REALSXP:
+                    implicit = "numeric";
+                    break;
+                case INTSXP:
+                    implicit = "integer";
+                    break;
+                case LGLSXP:
+                    implicit = "logical";
+                    break;
+                case STRSXP:
+                    implicit = "character";
+                    break;
+                case CLOSXP:
+                case BUILTINSXP:
+                case SPECIALSXP:
+                    implicit = "function";
+                    break;
+                case SYMSXP:
+                    implicit = "name";
+                    break;
+                case LANGSXP:
+                    implicit = "call";
+                    break;
+                default:
+                    implicit = Rf_type2char(type);
+                    break;
+                }
+                result.push_back(picojson::value(implicit));
+                return picojson::value(std::move(result));
+            }
+
+            picojson::value dims_to_json(SEXP sexp, SEXP klass, SEXP dims) {
+                picojson::array result;
+                if (TYPEOF(dims) == INTSXP) {
+                    for (R_xlen_t i = 0; i < Rf_xlength(dims); ++i) {
+                        result.push_back(picojson::value(static_cast<double>(INTEGER(dims)[i])));
+                    }
+                    return picojson::value(std::move(result));
+                }
+
+                if (TYPEOF(sexp) == VECSXP && TYPEOF(klass) == STRSXP && inherits(klass, "data.frame")) {
+                    // Row names are usually stored in compact form c(NA, -nrow) or c(NA, nrow).
+                    SEXP row_names = raw_attrib(sexp, R_RowNamesSymbol);
+                    double nrow = 0;
+                    if (TYPEOF(row_names) == INTSXP && Rf_xlength(row_names) == 2 && INTEGER(row_names)[0] == R_NaInt) {
+                        nrow = std::abs(INTEGER(row_names)[1]);
+                    } else if (row_names != R_NilValue) {
+                        nrow = static_cast<double>(Rf_xlength(row_names));
+                    }
+
+                    result.push_back(picojson::value(nrow));
+                    result.push_back(picojson::value(static_cast<double>(Rf_xlength(sexp))));
+                    return picojson::value(std::move(result));
+                }
+
+                return picojson::value();
+            }
+
+            picojson::value summarize_binding(SEXP name, SEXP env) {
+                picojson::array item;
+                item.push_back(picojson::value(Rchar_to_utf8(R_CHAR(name))));
+
+                auto unknown = [&](const char* type) {
+                    item.push_back(picojson::value(type));
+                    item.resize(6);
+                    return picojson::value(std::move(item));
+                };
+
+                SEXP sym = Rf_installChar(name);
+                if (R_BindingIsActive(sym, env)) {
+                    return unknown("active");
+                }
+
+                SEXP value = Rf_findVarInFrame(env, sym);
+                if (TYPEOF(value) == PROMSXP) {
+                    if (PRVALUE(value) == R_UnboundValue) {
+                        return unknown("promise");
+                    }
+                    value = PRVALUE(value);
+                }
+
+                int type = TYPEOF(value);
+                SEXP klass = Rf_getAttrib(value, R_ClassSymbol);
+                SEXP dims = Rf_getAttrib(value, R_DimSymbol);
+
+                item.push_back(picojson::value(Rf_type2char(type)));
+                item.push_back(class_to_json(klass, dims, type));
+                item.push_back(picojson::value(static_cast<double>(Rf_xlength(value))));
+                item.push_back(dims_to_json(value, klass, dims));
+                item.push_back(picojson::value(static_cast<double>(object_size(value))));
+                return picojson::value(std::move(item));
+            }
+        }
+
+        picojson::value summarize(SEXP env, size_t offset, size_t count) {
+            protected_sexp names(R_lsInternal3(env, R_TRUE, R_TRUE));
+            size_t total = Rf_xlength(names.get());
+
+            picojson::array items;
+            for (size_t i = offset; i < total && i - offset < count; ++i) {
+                items.push_back(summarize_binding(STRING_ELT(names.get(), i), env));
+            }
+
+            return picojson::value(picojson::array{ picojson::value(static_cast<double>(total)), picojson::value(std::move(items)) });
+        }
+
+        binding_tracker::binding_tracker(SEXP env) :
+            _env(env) {
+            capture(_bindings, _values);
+        }
+
+        void binding_tracker::capture(std::vector<binding>& bindings, protected_sexp& values) const {
+            bindings.clear();
+
+            auto capture_frame = [&](SEXP frame) {
+                for (; frame != R_NilValue; frame = CDR(frame)) {
+                    SEXP value = CAR(frame);
+                    if (value == R_UnboundValue) {
+                        continue;
+                    }
+
+                    bool is_forced = TYPEOF(value) == PROMSXP && PRVALUE(value) != R_UnboundValue;
+                    bindings.push_back(binding{ TAG(frame), value, is_forced });
+                }
+            };
+
+            SEXP table = HASHTAB(_env.get());
+            if (table != R_NilValue) {
+                for (R_xlen_t i = 0, n = Rf_xlength(table); i < n; ++i) {
+                    capture_frame(VECTOR_ELT(table, i));
+                }
+            } else {
+                capture_frame(FRAME(_env.get()));
+            }
+
+            // Symbols are unique, so they can be ordered by address to match bindings up by a linear merge.
+            std::sort(bindings.begin(), bindings.end(), [](const binding& x, const binding& y) {
+                return std::less<SEXP>()(x.sym, y.sym);
+            });
+
+            // All values are still reachable from the environment while the list is allocated.
+            values = Rf_allocVector(VECSXP, bindings.size());
+            for (size_t i = 0; i < bindings.size(); ++i) {
+                SEXP value = bindings[i].value;
+                SET_VECTOR_ELT(values.get(), i, value);
+
+                // Same as MARK_NOT_MUTABLE, which is a macro. Where R uses reference counts rather than NAMED, this is a
+                // no-op, but the reference from the list has the same effect. Environments are never copied, and
+                // promises are never modified other than by forcing them, so there's no point in marking those.
+                switch (TYPEOF(value)) {
+                case NILSXP:
+                case SYMSXP:
+                case ENVSXP:
+                case PROMSXP:
+                    break;
+                default:
+                    SET_NAMED(value, 2);
+                    break;
+                }
+            }
+        }
+
+        bool binding_tracker::update(picojson::array& added, picojson::array& removed, picojson::array& changed) {
+            protected_sexp new_values;
+            capture(_new_bindings, new_values);
+
+            auto name = [](const binding& b) {
+                return picojson::value(Rchar_to_utf8(R_CHAR(PRINTNAME(b.sym))));
+            };
+
+            bool any_changes = false;
+            auto old_it = _bindings.begin(), old_end = _bindings.end();
+            auto new_it = _new_bindings.begin(), new_end = _new_bindings.end();
+            while (old_it != old_end || new_it != new_end) {
+                if (new_it == new_end || (old_it != old_end && std::less<SEXP>()(old_it->sym, new_it->sym))) {
+                    removed.push_back(name(*old_it++));
+                    any_changes = true;
+                } else if (old_it == old_end || std::less<SEXP>()(new_it->sym, old_it->sym)) {
+                    added.push_back(name(*new_it++));
+                    any_changes = true;
+                } else {
+                    if (old_it->value != new_it->value || old_it->is_forced != new_it->is_forced) {
+                        changed.push_back(name(*new_it));
+                        any_changes = true;
+                    }
+                    ++old_it;
+                    ++new_it;
+                }
+            }
+
+            // Keep both buffers around, so that their storage is reused on subsequent updates.
+            _bindings.swap(_new_bindings);
+            _values = std::move(new_values);
+            return any_changes;
+        }
+    }
+}
@@ -0,0 +1,88 @@
+/* ****************************************************************************
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved. 
+ *
+ *
+ * This file is part of Microsoft R Host.
+ * 
+ * Microsoft R Host is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Microsoft R Host is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***************************************************************************/
+
+
+#pragma once
+#include "stdafx.h"
+#include "r_api.h"
+#include "util.h"
+
+namespace rhost {
+    namespace workspace {
+        // Summarizes the bindings in env, in the order of their names, from offset onward, up to count of them.
+        // Returns [total, items], where total is the number of bindings in env, and every item is:
+        //
+        //   [name, type, class, length, dims, size]
+        //
+        // type is typeof(); class is the class() vector; length is length(); dims are dim(), or [nrow, ncol] for
+        // data frames, or null; and size is the approximate number of bytes of memory used by the value.
+        //
+        // Nothing is evaluated to produce the summaries. Values of forced promises are summarized like any other
+        // values, but for promises that haven't been forced yet, type is "promise", and everything else is null.
+        // Active bindings are not invoked; type is "active", and everything else is null.
+        //
+        // Must be called on the R thread. Errors are reported via Rf_error.
+        picojson::value summarize(SEXP env, size_t offset, size_t count);
+
+        // Tracks which symbols are bound in an environment, so that every call to update() can report which of them
+        // were added, removed, or rebound to a different value since the previous call (or since construction).
+        //
+        // This is meant to be cheap enough to do on every prompt even for environments with many thousands of
+        // bindings, so the frame is walked directly, and values are compared by identity - they are never inspected,
+        // and neither promises nor active bindings are evaluated (but forcing a promise is reported as a change).
+        //
+        // To make identity meaningful, the tracker keeps the values it has seen alive until the next update, so
+        // that their addresses can't be reused, and marks them as shared, so that R copies them rather than modify
+        // them in place (e.g. on x[1] <- 0) - which is what it would do if the value were bound to another symbol
+        // as well. Thus, the first modification of a tracked value after every update costs a copy. Changes inside
+        // of environments bound in env (including reference class objects) are not changes of env itself.
+        //
+        // The base environment and user-defined databases don't have frames, and are always seen as empty.
+        //
+        // Must be used on the R thread.
+        class binding_tracker {
+        public:
+            explicit binding_tracker(SEXP env);
+
+            SEXP env() const {
+                return _env.get();
+            }
+
+            // Appends names (in UTF-8) of symbols that were added, removed or rebound to the corresponding arrays.
+            // Returns false if there were no changes.
+            bool update(picojson::array& added, picojson::array& removed, picojson::array& changed);
+
+        private:
+            struct binding {
+                SEXP sym;
+                SEXP value;
+                bool is_forced; // for promises
+            };
+
+            util::protected_sexp _env;
+            std::vector<binding> _bindings, _new_bindings;
+            util::protected_sexp _values; // list of values in _bindings, to keep them alive
+
+            void capture(std::vector<binding>& bindings, util::protected_sexp& values) const;
+        };
+    }
+}
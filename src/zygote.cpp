@@ -0,0 +1,134 @@
+/* ****************************************************************************
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved. 
+ *
+ *
+ * This file is part of Microsoft R Host.
+ * 
+ * Microsoft R Host is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Microsoft R Host is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***************************************************************************/
+
+#include "stdafx.h"
+#include "zygote.h"
+#include "log.h"
+
+using namespace rhost::log;
+
+namespace rhost {
+    namespace zygote {
+#ifdef _WIN32
+        session serve(const fs::path& socket_path) {
+            fatal_error("Zygote mode is not supported on Windows.");
+        }
+#else
+        namespace {
+            const size_t max_name_length = 256;
+
+            // How long a client has to send the name once it has connected, since the zygote can't accept any other
+            // connections in the meantime.
+            const long name_timeout_seconds = 5;
+
+            // The name becomes part of the log file name, so it can't contain path separators or control characters.
+            bool read_name(int fd, std::string& name) {
+                timeval timeout = { name_timeout_seconds, 0 };
+                setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+
+                for (;;) {
+                    char c;
+                    ssize_t n = read(fd, &c, 1);
+                    if (n < 0 && errno == EINTR) {
+                        continue;
+                    }
+                    if (n != 1) {
+                        return false;
+                    }
+                    if (c == '\n') {
+                        // The socket is about to become the transport, where reads must block indefinitely.
+                        timeval no_timeout = {};
+                        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &no_timeout, sizeof no_timeout);
+                        return true;
+                    }
+                    if (name.size() >= max_name_length || c == '/' || c == '\\' || static_cast<unsigned char>(c) < 0x20) {
+                        return false;
+                    }
+                    name += c;
+                }
+            }
+        }
+
+        session serve(const fs::path& socket_path) {
+            std::string path = socket_path.string();
+
+            sockaddr_un addr = {};
+            addr.sun_family = AF_UNIX;
+            if (path.size() >= sizeof addr.sun_path) {
+                fatal_error("Zygote socket path is too long: %s", path.c_str());
+            }
+            strcpy(addr.sun_path, path.c_str());
+
+            int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (listener < 0) {
+                fatal_error("Couldn't create zygote socket: %s", strerror(errno));
+            }
+
+            unlink(path.c_str());
+            if (bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof addr) != 0 || listen(listener, SOMAXCONN) != 0) {
+                fatal_error("Couldn't listen on zygote socket %s: %s", path.c_str(), strerror(errno));
+            }
+
+            // Children are independent hosts, and nobody is interested in their exit status.
+            signal(SIGCHLD, SIG_IGN);
+
+            logf(log_verbosity::minimal, "Zygote is listening on %s\n", path.c_str());
+            flush_log();
+
+            for (;;) {
+                int fd = accept(listener, nullptr, nullptr);
+                if (fd < 0) {
+                    if (errno == EINTR || errno == ECONNABORTED) {
+                        continue;
+                    }
+                    fatal_error("Couldn't accept connection on zygote socket: %s", strerror(errno));
+                }
+
+                std::string name;
+                if (!read_name(fd, name)) {
+                    logf(log_verbosity::minimal, "Zygote client disconnected, timed out, or sent an invalid name without requesting a host.\n");
+                    close(fd);
+                    continue;
+                }
+
+                // Anything still buffered would otherwise be written by both processes.
+                flush_log();
+
+                pid_t pid = fork();
+                if (pid == 0) {
+                    close(listener);
+                    signal(SIGCHLD, SIG_DFL);
+                    return session{ fd, name };
+                }
+
+                if (pid < 0) {
+                    logf(log_verbosity::minimal, "Zygote couldn't fork host for '%s': %s\n", name.c_str(), strerror(errno));
+                } else {
+                    logf(log_verbosity::minimal, "Zygote forked host %d for '%s'.\n", static_cast<int>(pid), name.c_str());
+                }
+                flush_log();
+                close(fd);
+            }
+        }
+#endif
+    }
+}
@@ -0,0 +1,48 @@
+/* ****************************************************************************
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved. 
+ *
+ *
+ * This file is part of Microsoft R Host.
+ * 
+ * Microsoft R Host is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Microsoft R Host is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***************************************************************************/
+
+#pragma once
+#include "stdafx.h"
+
+namespace rhost {
+    namespace zygote {
+        struct session {
+            // Connected socket to use for the transport.
+            int fd;
+            // Name requested by the client, or empty if none.
+            std::string name;
+        };
+
+        // Listens on a Unix domain socket at socket_path, and forks a new host process for every client that connects
+        // to it. The client sends the name for the new host, terminated by a newline (an empty line to use no name),
+        // and from then on, the connection is used as the transport for the forked host. The name must be sent within
+        // 5 seconds of connecting, must not be longer than 256 bytes, and can't contain slashes, backslashes or
+        // control characters; otherwise, the connection is closed.
+        //
+        // Only returns in the forked child, which continues with the state that the zygote had at the moment of the
+        // fork - so everything that's expensive to set up, and can be shared by all hosts, should be done before
+        // calling this. Since only the calling thread survives the fork, no other threads should be started until
+        // this returns. Per-process state that R set up before the fork, such as the session temp directory and the
+        // random seed, is shared with the zygote as well, and must be replaced by the child. Not supported on Windows.
+        session serve(const fs::path& socket_path);
+    }
+}
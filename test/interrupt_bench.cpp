@@ -0,0 +1,207 @@
+/* ****************************************************************************
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved. 
+ *
+ *
+ * This file is part of Microsoft R Host.
+ * 
+ * Microsoft R Host is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Microsoft R Host is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***************************************************************************/
+
+
+
+// Measures how long it takes from a cancel request until R acknowledges it, for each interrupt_delivery mode. The R
+// thread is simulated: "events" stand for R_ProcessEvents, which calls back into the host (CallBack on Windows,
+// R_PolledEvents on POSIX) where a pending cancellation is noticed; and R_interrupts_pending is checked the way R does
+// it, either right after processing events (R_CheckUserInterrupt), or on its own (END_SUSPEND_INTERRUPTS). The scenarios
+// are a loop that calls R_CheckUserInterrupt all the time, native code that only processes events every so often, and
+// a blocking wait such as Sys.sleep, which wakes up to process events every so often.
+//
+// POSIX only, since the signal delivery mode is.
+
+#include "stdafx.h"
+#include "eval.h"
+#include <algorithm>
+#include <random>
+#include <sys/select.h>
+
+using namespace rhost::eval;
+
+// Everything interrupt.cpp needs from eval.cpp and from R. Rf_onintr is never called by the benchmark.
+namespace rhost {
+    namespace eval {
+        bool was_eval_canceled;
+    }
+
+    namespace rapi {
+        decltype(RHOST_RAPI_PTR(Rf_onintr)) RHOST_RAPI_PTR(Rf_onintr);
+
+        int interrupts_pending;
+        decltype(RHOST_RAPI_PTR(R_interrupts_pending)) RHOST_RAPI_PTR(R_interrupts_pending) = &interrupts_pending;
+    }
+}
+
+namespace {
+    typedef std::chrono::steady_clock clock_type;
+
+    const int trial_count = 50;
+    const auto events_interval = std::chrono::milliseconds(50);
+
+    enum class scenario {
+        check_loop,
+        sparse_events,
+        blocking_wait,
+    };
+
+    std::atomic<bool> stop_requested(false);
+
+    // cancel_requested stands for the eval stack state that CallBack inspects; request_done is set once
+    // request_interrupt has returned, since retract_interrupt must not overlap with it.
+    std::atomic<bool> cancel_requested(false), request_done(false);
+    std::atomic<int> ack_count(0);
+    clock_type::time_point cancel_time, ack_time;
+
+    std::atomic<int> sink(0);
+
+    void acknowledge() {
+        ack_time = clock_type::now();
+        while (!request_done.load(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+
+        // What interrupt_eval or consume_interrupt do for the host, minus the longjmp. This is on the R thread, so it
+        // can't race with the signal handler.
+        retract_interrupt();
+        R_interrupts_pending = 0;
+        cancel_requested.store(false, std::memory_order_relaxed);
+        request_done.store(false, std::memory_order_relaxed);
+        ack_count.fetch_add(1, std::memory_order_release);
+    }
+
+    void process_events() {
+        if (cancel_requested.load(std::memory_order_acquire)) {
+            acknowledge();
+        }
+    }
+
+    void check_interrupts_pending() {
+        if (R_interrupts_pending) {
+            acknowledge();
+        }
+    }
+
+    void do_some_work() {
+        int n = 0;
+        for (int i = 0; i < 1000; ++i) {
+            n += i * i;
+        }
+        sink += n;
+    }
+
+    void run_r_thread(interrupt_delivery delivery, scenario sc, std::promise<void>& ready) {
+        set_interrupt_delivery(delivery);
+        ready.set_value();
+
+        auto next_events = clock_type::now() + events_interval;
+        while (!stop_requested.load(std::memory_order_relaxed)) {
+            switch (sc) {
+            case scenario::check_loop:
+                do_some_work();
+                process_events();
+                check_interrupts_pending();
+                break;
+
+            case scenario::sparse_events:
+                do_some_work();
+                check_interrupts_pending();
+                if (clock_type::now() >= next_events) {
+                    process_events();
+                    next_events = clock_type::now() + events_interval;
+                }
+                break;
+
+            case scenario::blocking_wait: {
+                // Unlike most system calls, select is never restarted after a signal handler runs.
+                auto usec = std::chrono::duration_cast<std::chrono::microseconds>(events_interval).count();
+                timeval tv = { static_cast<time_t>(usec / 1000000), static_cast<suseconds_t>(usec % 1000000) };
+                select(0, nullptr, nullptr, nullptr, &tv);
+                process_events();
+                check_interrupts_pending();
+                break;
+            }
+            }
+        }
+    }
+
+    void run(const char* delivery_name, interrupt_delivery delivery, const char* scenario_name, scenario sc) {
+        stop_requested = false;
+        std::promise<void> ready;
+        std::thread r_thread(run_r_thread, delivery, sc, std::ref(ready));
+        ready.get_future().wait();
+
+        // Requests come at random points relative to when R processes events, as they would from the client.
+        std::mt19937 rng(42);
+        std::uniform_int_distribution<int> delay_us(0, static_cast<int>(std::chrono::duration_cast<std::chrono::microseconds>(events_interval).count()));
+
+        std::vector<double> latencies;
+        for (int trial = 0; trial < trial_count; ++trial) {
+            std::this_thread::sleep_for(std::chrono::microseconds(delay_us(rng)));
+
+            int acks = ack_count.load(std::memory_order_acquire);
+            cancel_time = clock_type::now();
+            cancel_requested.store(true, std::memory_order_release);
+            request_interrupt();
+            request_done.store(true, std::memory_order_release);
+
+            while (ack_count.load(std::memory_order_acquire) == acks) {
+                std::this_thread::sleep_for(std::chrono::microseconds(10));
+            }
+
+            std::chrono::duration<double, std::micro> latency = ack_time - cancel_time;
+            latencies.push_back(latency.count());
+        }
+
+        stop_requested = true;
+        r_thread.join();
+
+        std::sort(latencies.begin(), latencies.end());
+        printf("%-10s %-16s median %10.1f us   max %10.1f us\n", delivery_name, scenario_name,
+            latencies[latencies.size() / 2], latencies.back());
+    }
+}
+
+int main() {
+    const std::pair<const char*, interrupt_delivery> deliveries[] = {
+        { "callback", interrupt_delivery::callback },
+        { "flag", interrupt_delivery::flag },
+        { "signal", interrupt_delivery::signal },
+    };
+
+    const std::pair<const char*, scenario> scenarios[] = {
+        { "check_loop", scenario::check_loop },
+        { "sparse_events", scenario::sparse_events },
+        { "blocking_wait", scenario::blocking_wait },
+    };
+
+    printf("Cancel request to acknowledgement, %d trials; events every %d ms outside of check_loop\n", trial_count,
+        static_cast<int>(events_interval.count()));
+    for (const auto& sc : scenarios) {
+        for (const auto& d : deliveries) {
+            run(d.first, d.second, sc.first, sc.second);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,178 @@
+/* ****************************************************************************
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved. 
+ *
+ *
+ * This file is part of Microsoft R Host.
+ * 
+ * Microsoft R Host is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Microsoft R Host is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***************************************************************************/
+
+
+// Tests for the parts of the host that messages go through on their way from the transport to the R thread and back,
+// which can run without R. Only message.cpp is linked in; everything it needs from the rest of the host is stubbed out
+// below.
+
+#include "stdafx.h"
+#include "message.h"
+#include "util.h"
+
+using namespace rhost::protocol;
+using namespace rhost::util;
+
+namespace rhost {
+    namespace log {
+        void vlogf(log_verbosity, log_level, const char*, va_list) {
+        }
+
+        void flush_log() {
+        }
+
+        void fatal_error(const char* format, ...) {
+            va_list va;
+            va_start(va, format);
+            vfprintf(stderr, format, va);
+            va_end(va);
+            std::abort();
+        }
+    }
+}
+
+namespace {
+    int failures = 0;
+
+#define CHECK(cond) \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+        ++failures; \
+    }
+
+    static_assert(!std::is_copy_constructible<message>::value && !std::is_copy_assignable<message>::value,
+        "message payloads must never be copied implicitly");
+
+    // The payload of a request must never be copied on its way from the transport, through the eval queue, to the code
+    // that handles it on the R thread; and the same goes for a response, through the response slot. Since std::string
+    // keeps its buffer when moved (as long as it's too long for the small string optimization), a payload that
+    // wasn't copied is still at the same address it was received at.
+    void payload_is_not_copied_on_round_trip() {
+        std::string blob(0x10000, 'x');
+        std::string wire = message(message::request_marker, "?=", picojson::array{ picojson::value("1 + 1") }, blob.data(), blob.size()).payload();
+        const char* received_at = wire.data();
+
+        int copies = 0;
+        auto check_payload = [&](const message& msg) {
+            if (msg.payload().data() != received_at) {
+                ++copies;
+                received_at = msg.payload().data();
+            }
+        };
+
+        // receive_worker parses the payload it has just read from the transport.
+        auto msg = message::parse(std::move(wire));
+        check_payload(msg);
+        CHECK(!strcmp(msg.name(), "?="));
+        CHECK(msg.blob_size() == blob.size());
+
+        // message_received queues it for the R thread ...
+        mpsc_queue<message> queue;
+        queue.push(std::move(msg));
+
+        // ... handle_pending_evals pops it ...
+        message popped;
+        CHECK(queue.try_pop(popped));
+        check_payload(popped);
+
+        // ... and send_request_and_get_response takes a response out of the response slot in the same way.
+        message response;
+        response = std::move(popped);
+        check_payload(response);
+        CHECK(response.json().size() == 1);
+
+        CHECK(copies == 0);
+    }
+
+    void mpsc_queue_is_fifo() {
+        mpsc_queue<int> queue;
+        CHECK(queue.empty());
+
+        int value = -1;
+        CHECK(!queue.try_pop(value));
+        CHECK(value == -1);
+
+        for (int i = 0; i < 100; ++i) {
+            queue.push(int(i));
+        }
+        CHECK(!queue.empty());
+
+        for (int i = 0; i < 100; ++i) {
+            CHECK(queue.try_pop(value));
+            CHECK(value == i);
+        }
+        CHECK(queue.empty());
+        CHECK(!queue.try_pop(value));
+    }
+
+    // With concurrent producers, values from different producers can interleave in any way, but those from the same
+    // producer must come out in the order in which they were pushed, and none can be lost.
+    void mpsc_queue_keeps_order_of_every_producer() {
+        const int producer_count = 4, values_per_producer = 100000;
+
+        mpsc_queue<std::pair<int, int>> queue;
+        std::vector<std::thread> producers;
+        for (int p = 0; p < producer_count; ++p) {
+            producers.emplace_back([&, p] {
+                for (int i = 0; i < values_per_producer; ++i) {
+                    queue.push(std::make_pair(p, i));
+                }
+            });
+        }
+
+        std::vector<int> next(producer_count, 0);
+        int count = 0;
+        bool in_order = true;
+        while (count < producer_count * values_per_producer) {
+            std::pair<int, int> value;
+            if (!queue.try_pop(value)) {
+                std::this_thread::yield();
+                continue;
+            }
+            in_order = in_order && value.second == next[value.first];
+            next[value.first] = value.second + 1;
+            ++count;
+        }
+
+        for (auto& t : producers) {
+            t.join();
+        }
+
+        CHECK(in_order);
+        CHECK(queue.empty());
+        for (int n : next) {
+            CHECK(n == values_per_producer);
+        }
+    }
+}
+
+int main() {
+    payload_is_not_copied_on_round_trip();
+    mpsc_queue_is_fifo();
+    mpsc_queue_keeps_order_of_every_producer();
+
+    if (failures) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
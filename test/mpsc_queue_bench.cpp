@@ -0,0 +1,116 @@
+/* ****************************************************************************
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved. 
+ *
+ *
+ * This file is part of Microsoft R Host.
+ * 
+ * Microsoft R Host is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Microsoft R Host is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***************************************************************************/
+
+
+// Measures what it costs the R thread to poll the eval request queue - which it does on every CallBack, and on every
+// iteration of the loop that waits for a response from the client - compared to the mutex-guarded std::queue that
+// was used before. Also measures push and pop throughput with a producer running concurrently with the consumer.
+
+#include "stdafx.h"
+#include "util.h"
+
+using namespace rhost::util;
+
+namespace {
+    const int poll_iterations = 100000000;
+    const int transfer_count = 1000000;
+
+    template <class F>
+    double ns_per_iteration(int iterations, F body) {
+        auto start = std::chrono::steady_clock::now();
+        body();
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        return elapsed.count() / iterations;
+    }
+
+    void report(const char* what, double ns) {
+        printf("%-40s %8.2f ns\n", what, ns);
+    }
+}
+
+int main() {
+    std::atomic<int> sink(0);
+
+    {
+        mpsc_queue<int> queue;
+        report("mpsc_queue empty poll", ns_per_iteration(poll_iterations, [&] {
+            int n = 0;
+            for (int i = 0; i < poll_iterations; ++i) {
+                n += queue.empty() ? 0 : 1;
+            }
+            sink += n;
+        }));
+    }
+
+    {
+        std::queue<int> queue;
+        std::mutex mutex;
+        report("std::queue + mutex empty poll", ns_per_iteration(poll_iterations, [&] {
+            int n = 0;
+            for (int i = 0; i < poll_iterations; ++i) {
+                std::lock_guard<std::mutex> lock(mutex);
+                n += queue.empty() ? 0 : 1;
+            }
+            sink += n;
+        }));
+    }
+
+    {
+        mpsc_queue<int> queue;
+        report("mpsc_queue push/pop, 1 producer", ns_per_iteration(transfer_count, [&] {
+            std::thread producer([&] {
+                for (int i = 0; i < transfer_count; ++i) {
+                    queue.push(int(i));
+                }
+            });
+            for (int received = 0, value; received < transfer_count; ) {
+                if (queue.try_pop(value)) {
+                    ++received;
+                }
+            }
+            producer.join();
+        }));
+    }
+
+    {
+        std::queue<int> queue;
+        std::mutex mutex;
+        report("std::queue + mutex push/pop, 1 producer", ns_per_iteration(transfer_count, [&] {
+            std::thread producer([&] {
+                for (int i = 0; i < transfer_count; ++i) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    queue.push(i);
+                }
+            });
+            for (int received = 0; received < transfer_count; ) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!queue.empty()) {
+                    queue.pop();
+                    ++received;
+                }
+            }
+            producer.join();
+        }));
+    }
+
+    return sink == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}